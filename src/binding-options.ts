@@ -3,7 +3,7 @@ import { Options } from "pkg-prebuilds";
 const options: Options = {
   name: "nodezt",
 
-  napi_versions: [5],
+  napi_versions: [6],
 };
 
 export = options;
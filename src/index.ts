@@ -24,6 +24,13 @@ export async function startNodeAndJoinNet(
 }
 
 export { events, SocketErrors } from "./module/zts";
+export type {
+  LatencyHistogram,
+  LatencyHistograms,
+  PeerInfo,
+} from "./module/zts";
+export type { Sample } from "./module/metrics";
+export { parseMetrics } from "./module/metrics";
 export { node };
 export * as dgram from "./module/dgram";
 export * as net from "./module/net";
@@ -1,6 +1,42 @@
 import { EventEmitter } from "events";
 import { InternalError, zts } from "./zts";
-import { isIPv6 } from "net";
+import { RecvRing } from "./ring";
+
+export { RecvRing };
+
+/** Length of an address in binary representation: 16 address bytes followed by the family, 4 or 6. */
+export const BINARY_ADDR_LEN = 17;
+
+/**
+ * Formats the `index`th address of packed binary addresses, e.g. those of a "batch" event with binaryAddresses enabled.
+ */
+export function formatAddress(addresses: Uint8Array, index = 0): string {
+  return zts.addr_format(addresses, index);
+}
+
+// parsed destinations of recent sends, in least recently used order
+const destinations = new Map<string, Uint8Array>();
+const DESTINATION_CACHE_SIZE = 256;
+
+/**
+ * Returns the binary representation of `address`, which the native side uses without parsing it again.
+ */
+function destination(address: string): string | Uint8Array {
+  let bin = destinations.get(address);
+  if (bin) {
+    destinations.delete(address);
+  } else {
+    bin = zts.addr_parse(address);
+    // invalid addresses are passed on as is, so they are reported like before
+    if (!bin) return address;
+    if (destinations.size >= DESTINATION_CACHE_SIZE) {
+      const oldest = destinations.keys().next();
+      if (!oldest.done) destinations.delete(oldest.value);
+    }
+  }
+  destinations.set(address, bin);
+  return bin;
+}
 
 interface UDPSocketEvents {
   close: () => void;
@@ -13,6 +49,16 @@ interface UDPSocketEvents {
       size: number;
     },
   ) => void;
+  /**
+   * Only emitted in batched mode. Datagram `i` is `data.subarray(table[4 * i], table[4 * i] + table[4 * i + 1])`,
+   * sent from port `table[4 * i + 2]` of `addresses[table[4 * i + 3]]`. With binaryAddresses, `addresses` holds the
+   * packed binary addresses instead, see formatAddress.
+   */
+  batch: (
+    data: Uint8Array,
+    table: Uint32Array,
+    addresses: string[] | Uint8Array,
+  ) => void;
   listening: () => void;
   error: (err: InternalError) => void;
 }
@@ -24,14 +70,19 @@ class Socket extends EventEmitter {
   private connected = false;
   private closed = false;
 
-  constructor(ipv6: boolean) {
+  private recvBufferSize = 4 * 1024 * 1024;
+  private recvPacketBudget = 1024;
+  private reusePort;
+
+  constructor(ipv6: boolean, reusePort = false) {
     super();
     this.ipv6 = ipv6;
+    this.reusePort = reusePort;
 
     this.internal = new zts.UDP(ipv6, (data, addr, port) => {
       this.emit("message", data, {
         address: addr,
-        family: isIPv6(addr) ? "udp6" : "udp4",
+        family: addr.includes(":") ? "udp6" : "udp4",
         port,
         size: data.length,
       });
@@ -56,6 +107,80 @@ class Socket extends EventEmitter {
     return this;
   }
 
+  /**
+   * Delivers datagrams that arrive while the event loop is busy together. They are emitted as a single "batch" event
+   * if there is a listener for it, and as separate "message" events with views on the batch otherwise.
+   */
+  setBatched() {
+    this.internal.setBatchCallback((data, table, addresses) => {
+      if (this.listenerCount("batch") > 0) {
+        this.emit("batch", data, table, addresses);
+        return;
+      }
+      const strings =
+        addresses instanceof Uint8Array
+          ? Array.from({ length: addresses.length / BINARY_ADDR_LEN }, (_, i) =>
+              formatAddress(addresses, i),
+            )
+          : addresses;
+      for (let i = 0; i < table.length; i += 4) {
+        const msg = data.subarray(table[i], table[i] + table[i + 1]);
+        const address = strings[table[i + 3]];
+        this.emit("message", msg, {
+          address,
+          family: address.includes(":") ? "udp6" : "udp4",
+          port: table[i + 2],
+          size: msg.length,
+        });
+      }
+    });
+  }
+
+  /**
+   * Makes the socket write received datagrams to `ring` instead of emitting "message" or "batch" events. The ring can
+   * be read with RecvRing.poll from this thread or, with a RecvRing created from the same buffer, from a worker. The
+   * ring can't be changed afterwards.
+   */
+  setRing(ring: RecvRing) {
+    this.internal.setRing(new Uint8Array(ring.buffer), () => ring.notify());
+  }
+
+  /**
+   * Makes "batch" events carry the source addresses in packed binary representation instead of as strings.
+   */
+  setBinaryAddresses(enable: boolean) {
+    this.internal.binaryAddresses(enable);
+  }
+
+  /**
+   * Limits the size of received datagrams waiting for the "message" event, datagrams received beyond it are dropped.
+   * Default: 4 MiB. There is no kernel socket, so unlike node:dgram this doesn't set SO_RCVBUF but this budget.
+   */
+  setRecvBufferSize(size: number) {
+    this.internal.recvBudget(size, this.recvPacketBudget);
+    this.recvBufferSize = size;
+  }
+
+  getRecvBufferSize() {
+    return this.recvBufferSize;
+  }
+
+  /**
+   * Limits the number of received datagrams waiting for the "message" event, datagrams received beyond it are dropped.
+   * Default: 1024.
+   */
+  setRecvPacketBudget(packets: number) {
+    this.internal.recvBudget(this.recvBufferSize, packets);
+    this.recvPacketBudget = packets;
+  }
+
+  /**
+   * Number of datagrams dropped because the receive budget was exhausted.
+   */
+  get droppedMessages(): number {
+    return this.internal.dropped();
+  }
+
   address() {
     this.checkClosed();
     if (!this.bound) throw Error("Unbound socket");
@@ -81,7 +206,7 @@ class Socket extends EventEmitter {
     if (callback) this.once("listening", () => callback());
 
     this.internal
-      .bind(address, port)
+      .bind(address, port, this.reusePort)
       .then(() => this.emit("listening"))
       .catch((reason) => this.handleError()(reason));
   }
@@ -101,7 +226,36 @@ class Socket extends EventEmitter {
     if (!address) address = this.ipv6 ? "::1" : "127.0.0.1";
 
     this.internal
-      .send(msg, address, port)
+      .send(msg, destination(address), port)
+      .then(() => {
+        if (!this.bound) this.emit("listening");
+        this.handleError(callback)();
+      })
+      .catch((reason) => this.handleError(callback)(reason));
+  }
+
+  /**
+   * Splits `msg` into datagrams of `segmentSize` bytes, the last one possibly shorter, and sends them all to the same
+   * destination in a single call into the network stack. On failure the error's `sent` field holds the number of
+   * datagrams that were sent before it.
+   */
+  sendSegments(
+    msg: Uint8Array,
+    segmentSize: number,
+    port?: number,
+    address?: string,
+    callback?: (err?: InternalError) => void,
+  ): void {
+    this.checkClosed();
+    if (this.connected) {
+      port = 0;
+    } else {
+      if (!port) throw Error("Port must be specified on unconnected socket");
+    }
+    if (!address) address = this.ipv6 ? "::1" : "127.0.0.1";
+
+    this.internal
+      .sendSegments(msg, segmentSize, destination(address), port)
       .then(() => {
         if (!this.bound) this.emit("listening");
         this.handleError(callback)();
@@ -109,6 +263,57 @@ class Socket extends EventEmitter {
       .catch((reason) => this.handleError(callback)(reason));
   }
 
+  /**
+   * Sends all `messages` in a single call into the network stack. Messages that share the same buffer are only copied
+   * once, so broadcasting the same state to many peers costs a single copy.
+   *
+   * @param callback called with the lwIP error code of every message, 0 if it was sent
+   */
+  sendMany(
+    messages: { msg: Uint8Array; port?: number; address?: string }[],
+    callback?: (err: InternalError | undefined, errors?: Int32Array) => void,
+  ): void {
+    this.checkClosed();
+
+    const offsets = new Map<Uint8Array, number>();
+    const addresses = new Map<string, number>();
+    const addressList: string[] = [];
+    const table = new Uint32Array(messages.length * 4);
+    let size = 0;
+    for (const { msg } of messages) {
+      if (offsets.has(msg)) continue;
+      offsets.set(msg, size);
+      size += msg.length;
+    }
+    const data = new Uint8Array(size);
+    offsets.forEach((offset, msg) => data.set(msg, offset));
+
+    messages.forEach(({ msg, port, address }, i) => {
+      if (this.connected) port = 0;
+      else if (!port)
+        throw Error("Port must be specified on unconnected socket");
+      if (!address) address = this.ipv6 ? "::1" : "127.0.0.1";
+      let index = addresses.get(address);
+      if (index === undefined) {
+        index = addressList.push(address) - 1;
+        addresses.set(address, index);
+      }
+
+      table[i * 4] = offsets.get(msg) ?? 0;
+      table[i * 4 + 1] = msg.length;
+      table[i * 4 + 2] = port;
+      table[i * 4 + 3] = index;
+    });
+
+    this.internal
+      .sendMany(data, table, packAddresses(addressList))
+      .then((errors) => {
+        if (!this.bound) this.emit("listening");
+        callback?.(undefined, errors);
+      })
+      .catch((reason) => this.handleError(callback)(reason));
+  }
+
   close(callback?: () => void) {
     this.checkClosed();
     this.closed = true;
@@ -126,7 +331,7 @@ class Socket extends EventEmitter {
     if (!address) address = this.ipv6 ? "::1" : "127.0.0.1";
 
     this.internal
-      .connect(address, port)
+      .connect(destination(address), port)
       .then(() => {
         // if connect fails, shouldn't reuse callback for later try, so only add as listener here
         if (callback) this.once("connect", callback);
@@ -141,6 +346,49 @@ class Socket extends EventEmitter {
     this.connected = false;
   }
 
+  /**
+   * Joins the multicast group `multicastAddress` on the interface with address `multicastInterface`, or on all
+   * interfaces. Errors are emitted as "error" events.
+   *
+   * Receiving multicast isn't supported: the group is joined in lwIP only, the ZeroTier node isn't subscribed to it,
+   * so its datagrams never arrive. Sending to a group works without joining it.
+   */
+  addMembership(multicastAddress: string, multicastInterface?: string) {
+    this.checkClosed();
+    this.internal
+      .addMembership(multicastAddress, multicastInterface)
+      .catch((reason) => this.handleError()(reason));
+  }
+
+  dropMembership(multicastAddress: string, multicastInterface?: string) {
+    this.checkClosed();
+    this.internal
+      .dropMembership(multicastAddress, multicastInterface)
+      .catch((reason) => this.handleError()(reason));
+  }
+
+  /**
+   * Sends outgoing multicast datagrams on the interface with address `multicastInterface`.
+   */
+  setMulticastInterface(multicastInterface: string) {
+    this.checkClosed();
+    this.internal
+      .setMulticastInterface(multicastInterface)
+      .catch((reason) => this.handleError()(reason));
+  }
+
+  setMulticastTTL(ttl: number) {
+    this.checkClosed();
+    this.internal.setMulticastTTL(ttl);
+    return ttl;
+  }
+
+  setMulticastLoopback(flag: boolean) {
+    this.checkClosed();
+    this.internal.setMulticastLoopback(flag);
+    return flag;
+  }
+
   private handleError(callback?: (err?: InternalError) => void) {
     return (err?: Error) => {
       if (callback) callback(err);
@@ -159,12 +407,42 @@ class Socket extends EventEmitter {
   }
 }
 
+/**
+ * Packs addresses in binary representation, falls back to strings if one of them is invalid so it is reported natively.
+ */
+function packAddresses(addresses: string[]): string[] | Uint8Array {
+  const packed = new Uint8Array(addresses.length * BINARY_ADDR_LEN);
+  for (let i = 0; i < addresses.length; i++) {
+    const bin = destination(addresses[i]);
+    if (typeof bin === "string") return addresses;
+    packed.set(bin, i * BINARY_ADDR_LEN);
+  }
+  return packed;
+}
+
 export function createSocket(
-  options: { type: "udp4" | "udp6" },
+  options: {
+    type: "udp4" | "udp6";
+    recvBufferSize?: number;
+    recvPacketBudget?: number;
+    /** see Socket.setBatched */
+    batch?: boolean;
+    /** see Socket.setBinaryAddresses */
+    binaryAddresses?: boolean;
+    /**
+     * Share the port with sockets in other threads (see worker_threads) that bind it with reusePort as well. Received
+     * datagrams are distributed among them by source address and port, so each flow is handled by a single thread.
+     */
+    reusePort?: boolean;
+  },
   callback?: UDPSocketEvents["message"],
 ) {
   const ipv6 = options.type === "udp6";
-  const s = new Socket(ipv6);
+  const s = new Socket(ipv6, options.reusePort);
+  if (options.recvBufferSize) s.setRecvBufferSize(options.recvBufferSize);
+  if (options.recvPacketBudget) s.setRecvPacketBudget(options.recvPacketBudget);
+  if (options.batch) s.setBatched();
+  if (options.binaryAddresses) s.setBinaryAddresses(true);
   if (callback) s.on("message", callback);
 
   return s;
@@ -0,0 +1,62 @@
+/**
+ * Parser for the Prometheus text exposition returned by node.getMetrics. This module doesn't load the native binding.
+ */
+
+export interface Sample {
+  name: string;
+  labels: Record<string, string>;
+  value: number;
+}
+
+const UNESCAPE: Record<string, string> = { n: "\n", "\\": "\\", '"': '"' };
+
+function parseValue(value: string): number {
+  if (value === "+Inf") return Infinity;
+  if (value === "-Inf") return -Infinity;
+  return parseFloat(value);
+}
+
+/**
+ * Parses every sample of a Prometheus text exposition, comments and type information are skipped.
+ */
+export function parseMetrics(text: string): Sample[] {
+  const samples: Sample[] = [];
+
+  text.split("\n").forEach((line) => {
+    line = line.trim();
+    if (line === "" || line[0] === "#") return;
+
+    const labels: Record<string, string> = {};
+    let i = 0;
+    while (i < line.length && line[i] !== "{" && line[i] !== " ") i++;
+    const name = line.slice(0, i);
+
+    if (line[i] === "{") {
+      i++;
+      while (i < line.length && line[i] !== "}") {
+        const eq = line.indexOf("=", i);
+        const key = line.slice(i, eq).trim();
+        // value is a quoted string with \\, \" and \n escapes
+        let value = "";
+        i = eq + 2;
+        while (i < line.length && line[i] !== '"') {
+          if (line[i] === "\\") {
+            i++;
+            value += UNESCAPE[line[i]] ?? line[i];
+          } else value += line[i];
+          i++;
+        }
+        labels[key] = value;
+        i++;
+        if (line[i] === ",") i++;
+      }
+      i++;
+    }
+
+    // the value may be followed by a timestamp
+    const value = line.slice(i).trim().split(" ")[0];
+    samples.push({ name, labels, value: parseValue(value) });
+  });
+
+  return samples;
+}
@@ -7,65 +7,157 @@ import {
   SocketErrors,
   zts,
 } from "./zts";
-import { Duplex, DuplexOptions, PassThrough } from "node:stream";
+import { Duplex, DuplexOptions } from "node:stream";
 
 import * as node_net from "node:net";
+import { BINARY_ADDR_LEN } from "./dgram";
 import { checkPort } from "./util";
 import { setTimeout } from "node:timers/promises";
 
+/**
+ * libzt specific socket options.
+ */
+export interface ZtSocketOpts {
+  /**
+   * Hand received data to the application as views on lwIP's own buffers instead of copying it. The memory is only
+   * returned to lwIP once the chunks have been garbage collected, until then it counts against the receive buffer and
+   * keeps the window closed. This should only be used by consumers that don't hold on to received data.
+   * Default: false
+   */
+  zeroCopyReceive?: boolean;
+  /**
+   * Received data is merged into chunks of at most this many bytes when it is read. Has no effect on zero-copy receive,
+   * which delivers a chunk per lwIP buffer.
+   * Default: 65536
+   */
+  receiveChunkSize?: number;
+  /**
+   * Amount of received but unconsumed data after which the receive window closes. The advertised window can't exceed
+   * lwIP's TCP_WND, a larger buffer lets the window be reopened before the data has been consumed.
+   * Default: TCP_WND
+   */
+  receiveBufferSize?: number;
+  /**
+   * Enables receive buffer autotuning: the buffer grows up to this size when the application drains data faster than
+   * the buffer allows.
+   * Default: undefined (no autotuning)
+   */
+  receiveBufferMax?: number;
+  /**
+   * Limit on received but unread bytes. Data arriving beyond it is refused and redelivered by lwIP once the application
+   * has read enough, so memory stays bounded even if the peer ignores the window.
+   * Default: receive buffer size plus TCP_WND
+   */
+  receiveBudget?: number;
+  /**
+   * Limit on the number of received lwIP buffers waiting to be read, which bounds memory for peers sending many small
+   * segments. Data arriving beyond it is refused like for receiveBudget.
+   * Default: 1024
+   */
+  receivePacketBudget?: number;
+  /**
+   * Let lwIP reference written chunks instead of copying them. A chunk must not be modified until the socket emits
+   * "released" with a byte count covering it, i.e. at least the value of bytesWritten after the chunk was written.
+   * Default: false
+   */
+  noCopySend?: boolean;
+}
+
+let infoFields: string[] | undefined;
+
+/**
+ * Names of the values in a TCP info snapshot (see Socket.getInfo), in order. Times are in ms, windows and buffer sizes
+ * in bytes.
+ */
+export function getInfoFields(): string[] {
+  if (!infoFields) infoFields = zts.Socket.infoFields();
+  return infoFields;
+}
+
+/**
+ * TCP info of every connection of a server, see Server.connectionsInfo.
+ */
+export interface ConnectionsInfo {
+  /** number of connections, rows `0` to `count - 1` are valid */
+  count: number;
+  /** one row of getInfoFields().length values per connection */
+  info: Float64Array;
+  /** remote address of every row in binary representation, see dgram.formatAddress */
+  addresses: Uint8Array;
+}
+
 export class Server extends EventEmitter implements node_net.Server {
   listening = false;
 
   private internalServer?: InternalServer;
   connections!: number; // wrong in @types/node, not used
-  maxConnections!: number; // can be set to configure but normally undefined
 
   private connAmount = 0;
+  private connectionLimit = Infinity;
+  private socketOpts: ZtSocketOpts;
 
   constructor(
-    options: Record<string, never>,
+    options: ZtSocketOpts,
     connectionListener?: (socket: Socket) => void,
   ) {
     super();
+    this.socketOpts = options;
     this.once("close", () => (this.connAmount = -1));
     if (connectionListener) this.on("connection", connectionListener);
   }
 
+  /**
+   * Connections beyond this limit are rejected by the native accept queue before a socket is created for them, every
+   * rejected connection emits "drop".
+   */
+  get maxConnections(): number {
+    return this.connectionLimit;
+  }
+  set maxConnections(max: number) {
+    this.connectionLimit = max;
+    this.internalServer?.maxConnections(isFinite(max) ? max : -1);
+  }
+
   private internalConnectionHandler(
     error: InternalError | undefined,
-    socket: InternalSocket,
-    addrInfo: AddrInfo,
+    sockets: InternalSocket[],
+    addrInfos: AddrInfo[],
+    dropped: number,
   ): void {
-    if (
-      this.maxConnections !== undefined &&
-      this.maxConnections <= this.connAmount
-    ) {
-      //socket.
-      // TODO terminate incoming connection (after obtaining address)
-      // TODO local address
-      this.emit("drop", {});
-      return;
-    }
+    if (error) return this.handleError(error);
 
-    const s = new Socket({}, socket, addrInfo);
+    for (let i = 0; i < dropped; i++) this.emit("drop", {});
 
-    this.connAmount++;
-    s.once("close", () => {
-      this.connAmount--;
-      if (!this.internalServer && this.connAmount === 0) {
-        this.emit("close");
-      }
+    sockets.forEach((socket, i) => {
+      const s = new Socket(this.socketOpts, socket, addrInfos[i]);
+
+      this.connAmount++;
+      s.once("close", () => {
+        this.connAmount--;
+        if (!this.internalServer && this.connAmount === 0) {
+          this.emit("close");
+        }
+      });
+      process.nextTick(() => this.emit("connection", s));
     });
-    process.nextTick(() => this.emit("connection", s));
   }
 
-  private async internalListen(port: number, host: string): Promise<void> {
+  private async internalListen(
+    port: number,
+    host: string,
+    backlog: number,
+    reusePort: boolean,
+  ): Promise<void> {
     try {
       this.internalServer = await zts.Server.createServer(
         port,
         host,
+        backlog,
+        reusePort,
         this.internalConnectionHandler.bind(this),
       );
+      if (isFinite(this.connectionLimit))
+        this.internalServer.maxConnections(this.connectionLimit);
       this.listening = true;
       this.emit("listening");
     } catch (error: unknown) {
@@ -79,6 +171,35 @@ export class Server extends EventEmitter implements node_net.Server {
     return this.internalServer?.address() ?? null;
   }
 
+  /**
+   * Snapshots the TCP info of every open connection in a single call. Pass the result of a previous call to reuse its
+   * arrays, they are only replaced when there are more connections than they have room for.
+   */
+  async connectionsInfo(into?: ConnectionsInfo): Promise<ConnectionsInfo> {
+    const fields = getInfoFields().length;
+    const result = into ?? {
+      count: 0,
+      info: new Float64Array(0),
+      addresses: new Uint8Array(0),
+    };
+    if (!this.internalServer) {
+      result.count = 0;
+      return result;
+    }
+
+    for (;;) {
+      result.count = await this.internalServer.connectionsInfo(
+        result.info,
+        result.addresses,
+      );
+      if (result.count * fields <= result.info.length) return result;
+      // leave room for connections accepted in the meantime
+      const rows = Math.ceil(result.count * 1.25);
+      result.info = new Float64Array(rows * fields);
+      result.addresses = new Uint8Array(rows * BINARY_ADDR_LEN);
+    }
+  }
+
   [Symbol.asyncDispose](): Promise<void> {
     return new Promise((resolve) => this.close(() => resolve()));
   }
@@ -109,6 +230,11 @@ export class Server extends EventEmitter implements node_net.Server {
     let options: node_net.ListenOptions & {
       port: number;
       callback?: () => void;
+      /**
+       * Share the port with servers in other threads (see worker_threads) that listen on it with reusePort as well.
+       * Incoming connections are distributed among them.
+       */
+      reusePort?: boolean;
     } = { port: 0 };
 
     const arg0 = args[0];
@@ -127,9 +253,14 @@ export class Server extends EventEmitter implements node_net.Server {
 
     if (options.signal && !options.signal.aborted)
       options.signal.onabort = () => this.close();
-    // TODO backlog and other node_net.ListenOptions (ipv4/ipv6)
+    // TODO other node_net.ListenOptions (ipv4/ipv6)
 
-    this.internalListen(options.port, options.host ?? "::");
+    this.internalListen(
+      options.port,
+      options.host ?? "::",
+      options.backlog ?? 511,
+      options.reusePort ?? false,
+    );
 
     return this;
   }
@@ -176,8 +307,17 @@ export class Server extends EventEmitter implements node_net.Server {
 
 export function createServer(
   connectionListener?: (socket: Socket) => void,
+): Server;
+export function createServer(
+  options: ZtSocketOpts,
+  connectionListener?: (socket: Socket) => void,
+): Server;
+export function createServer(
+  options?: ZtSocketOpts | ((socket: Socket) => void),
+  connectionListener?: (socket: Socket) => void,
 ): Server {
-  return new Server({}, connectionListener);
+  if (typeof options === "function") return new Server({}, options);
+  return new Server(options ?? {}, connectionListener);
 }
 
 /**
@@ -200,12 +340,14 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
   bytesRead = 0;
   bytesWritten = 0;
   bytesAcked = 0;
+  bytesReleased = 0;
+
+  timeout?: number;
 
-  // internal socket writes to receiver, receiver writes to duplex (which is read by client application)
-  private receiver = new PassThrough();
+  private noCopySend: boolean;
 
   constructor(
-    options: node_net.SocketConstructorOpts,
+    options: node_net.SocketConstructorOpts & ZtSocketOpts,
     internal?: InternalSocket,
     addrInfo?: AddrInfo,
   ) {
@@ -218,6 +360,20 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     if (internal) this.connected = true;
     if (addrInfo) this.setAddrInfo(addrInfo);
     this.internalSocket = internal ?? new zts.Socket();
+    this.noCopySend = options.noCopySend ?? false;
+    if (options.zeroCopyReceive) this.internalSocket.zeroCopyRecv(true);
+    if (options.receiveChunkSize)
+      this.internalSocket.recvChunkSize(options.receiveChunkSize);
+    if (options.receiveBufferSize || options.receiveBufferMax)
+      this.internalSocket.recvBuffer(
+        options.receiveBufferSize ?? 0,
+        options.receiveBufferMax ?? 0,
+      );
+    if (options.receiveBudget || options.receivePacketBudget)
+      this.internalSocket.recvBudget(
+        options.receiveBudget ?? 0,
+        options.receivePacketBudget ?? 1024,
+      );
 
     // events from native socket
     this.internalEvents.on("connect", (addrInfo: AddrInfo) => {
@@ -225,25 +381,23 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
       this.setAddrInfo(addrInfo);
       this.emit("connect");
     });
-    this.internalEvents.on("data", (data?: Uint8Array) => {
-      if (data) {
-        // console.log(`received ${data.length}`);
-
-        this.bytesRead += data.length;
-        this.receiver.write(data, undefined, () => {
-          // console.log(`acking ${data.length}`);
-          this.internalSocket.ack(data.length);
-        });
-      } else {
-        // other side closed the connection
-        this.receiver.end();
-        if (this.readableLength === 0) this.resume();
-      }
+    // received data stays queued in the native socket until _read pulls it
+    this.internalEvents.on("readable", () =>
+      this._read(this.readableHighWaterMark),
+    );
+    this.internalEvents.on("end", () => {
+      // other side closed the connection, make sure the end is noticed even if nothing is reading
+      if (this.readableLength === 0) this.resume();
     });
     this.internalEvents.on("sent", (length) => {
       // console.log(`internal has sent ${length}`);
       this.bytesAcked += length;
     });
+    this.internalEvents.on("released", (offset: number) => {
+      this.bytesReleased = offset;
+      this.emit("released", offset);
+    });
+    this.internalEvents.on("timeout", () => this.emit("timeout"));
     this.internalEvents.on("close", () => {
       // TODO: is this actually necessary?
       // console.log("internal socket closed");
@@ -256,16 +410,6 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     this.internalSocket.setEmitter((event: string, ...args: unknown[]) =>
       this.internalEvents.emit(event, ...args),
     );
-
-    // setup passthrough for receiving data
-    this.receiver.on("data", (chunk) => {
-      if (!this.push(chunk)) this.receiver.pause();
-    });
-    this.receiver.on("end", () => {
-      this.push(null);
-      // if (this.receiver.readableLength === 0 && this.receiver.isPaused()) this.receiver.resume();
-    });
-    this.receiver.pause();
   }
 
   protected setAddrInfo(addrInfo: AddrInfo) {
@@ -277,8 +421,19 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     this.remoteFamily = addrInfo.remoteFamily;
   }
 
-  _read() {
-    this.receiver.resume();
+  _read(size: number) {
+    const chunks = this.internalSocket.read(size);
+    // nothing received yet, native socket emits "readable" once there is
+    if (chunks === undefined) return;
+
+    if (chunks === null) {
+      this.push(null);
+      return;
+    }
+    for (const chunk of chunks) {
+      this.bytesRead += chunk.length;
+      this.push(chunk);
+    }
   }
 
   _write(
@@ -291,29 +446,41 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     else this.realWrite(chunk, callback);
   }
 
-  private async realWrite(
-    chunk: Uint8Array,
+  _writev(
+    chunks: { chunk: Uint8Array }[],
     callback: (error?: Error | null) => void,
-  ): Promise<void> {
-    const currentAcked = this.bytesAcked;
-    const length = await this.internalSocket.send(chunk);
-    this.bytesWritten += length;
+  ): void {
+    const buffers = chunks.map(({ chunk }) => chunk);
+    if (!this.connected)
+      this.once("connect", () => this.realWrite(buffers, callback));
+    else this.realWrite(buffers, callback);
+  }
 
-    // everything was written out
-    if (length === chunk.length) {
-      callback();
-      return;
+  private realWrite(
+    chunk: Uint8Array | Uint8Array[],
+    callback: (error?: Error | null) => void,
+  ): void {
+    // the native socket queues whatever doesn't fit in the send buffer and writes it out as acks come in
+    let written: Promise<void>;
+    if (Array.isArray(chunk)) {
+      // corked or buffered writes go out in a single visit to the tcpip thread
+      written = this.internalSocket.sendv(chunk, this.noCopySend);
+      for (const buffer of chunk) this.bytesWritten += buffer.length;
+    } else {
+      written = this.internalSocket.send(chunk, this.noCopySend);
+      this.bytesWritten += chunk.length;
     }
 
-    // not everything was written out
-    const continuation = () => {
-      this.realWrite(chunk.subarray(length), callback);
-    };
-
-    // new space became available in the time it took to sync threads
-    if (currentAcked !== this.bytesAcked) continuation();
-    // wait for more space to become available
-    else this.internalEvents.once("sent", continuation);
+    if (this.internalSocket.queued() < this.writableHighWaterMark) {
+      // the callback has already been called, a write failing later destroys the socket
+      written.catch((err: Error) => {
+        if (!this.destroyed) this.destroy(err);
+      });
+      callback();
+    } else {
+      // above the high water mark, hold off on more writes until this one is out
+      written.then(() => callback(), callback);
+    }
   }
 
   _final(callback: (error?: Error | null | undefined) => void): void {
@@ -374,8 +541,28 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     } else return {};
   }
 
+  /**
+   * Emits "timeout" once the socket has been idle for `timeout` ms. The timeout is tracked natively, idle sockets cost no
+   * js timers. Like for node's sockets, the connection isn't closed.
+   */
   setTimeout(timeout: number, callback?: () => void): this {
-    throw Error("not yet implemented"); // TODO
+    this.timeout = timeout;
+    this.internalSocket.setTimeout(timeout);
+    if (callback) {
+      if (timeout === 0) this.removeListener("timeout", callback);
+      else this.once("timeout", callback);
+    }
+    return this;
+  }
+
+  /**
+   * Snapshots the connection's congestion control and queue state (cwnd, smoothed rtt, retransmits, queue lengths...),
+   * see getInfoFields for the meaning of every value. Pass the array of a previous call to reuse it.
+   */
+  async getInfo(into?: Float64Array): Promise<Float64Array> {
+    const out = into ?? new Float64Array(getInfoFields().length);
+    await this.internalSocket.getInfo(out);
+    return out;
   }
 
   setNoDelay(noDelay: boolean = true): this {
@@ -383,8 +570,13 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
     return this;
   }
 
-  setKeepAlive(enable?: boolean, initialDelay?: number): this {
-    throw Error("not yet implemented"); // TODO
+  /**
+   * Enables lwIP's keepalive probes, the first one after `initialDelay` ms without activity (0 keeps the default). Like
+   * node, probes are then sent every second and the connection is dropped after 10 unanswered probes.
+   */
+  setKeepAlive(enable: boolean = false, initialDelay: number = 0): this {
+    this.internalSocket.keepAlive(enable, initialDelay, 1000, 10);
+    return this;
   }
 
   resetAndDestroy(): this {
@@ -397,7 +589,7 @@ class Socket extends Duplex /*implements node_net.Socket*/ {
 } // class Socket
 
 function _createConnection(
-  options: node_net.TcpNetConnectOpts,
+  options: node_net.TcpNetConnectOpts & ZtSocketOpts,
   connectionListener?: () => void,
 ): Socket {
   const socket = new Socket(options);
@@ -410,7 +602,7 @@ function _createConnection(
 } // class Socket
 
 export function createConnection(
-  options: node_net.NetConnectOpts,
+  options: node_net.NetConnectOpts & ZtSocketOpts,
   connectionListener?: () => void,
 ): Socket;
 export function createConnection(
@@ -423,7 +615,7 @@ export function createConnection(
   connectionListener?: () => void,
 ): Socket;
 export function createConnection(
-  port: number | string | node_net.NetConnectOpts,
+  port: number | string | (node_net.NetConnectOpts & ZtSocketOpts),
   host?: string | (() => void),
   connectionListener?: () => void,
 ): Socket {
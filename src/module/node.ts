@@ -1,5 +1,6 @@
 import { setTimeout } from "timers/promises";
-import { zts } from "./zts";
+import { parseMetrics, Sample } from "./metrics";
+import { LatencyHistograms, PeerInfo, zts } from "./zts";
 
 // INIT
 
@@ -21,9 +22,11 @@ interface NodeStartOpts {
   /**
    * This callback receives info about libzt's events. API highly subject to change to become more idiomatic.
    * @param event
+   * @param peer the peer's new state for peer events (ZTS_EVENT_PEER_DIRECT, _RELAY, _UNREACHABLE, _PATH_DISCOVERED and
+   * _PATH_DEAD), e.g. to re-dial once a relayed peer becomes directly reachable
    * @returns
    */
-  eventListener?: (event: number) => void;
+  eventListener?: (event: number, peer?: PeerInfo) => void;
 }
 
 enum NodeState {
@@ -33,23 +36,32 @@ enum NodeState {
 }
 
 let state: NodeState = NodeState.INIT;
-let onEvent: (event: number) => void = () => undefined;
+let onEvent: (event: number, peer?: PeerInfo) => void = () => undefined;
 
-export function setEventHandler(callback: (event: number) => void) {
+export function setEventHandler(
+  callback: (event: number, peer?: PeerInfo) => void,
+) {
   onEvent = callback;
 }
 
+/**
+ * Starts the node. The node is shared by all threads of the process (see worker_threads): if another thread already
+ * started it, this attaches to the running node instead and `path` and `key` are ignored. The node keeps running until
+ * every thread that started it has freed it.
+ */
 export async function start(opts?: NodeStartOpts): Promise<string> {
   if (state !== NodeState.INIT) {
     throw Error("Node has already been started or freed.");
   }
 
   if (opts) {
-    if (opts.key) {
-      zts.init_from_memory(opts.key);
-    }
-    if (opts.path) {
-      zts.init_from_storage(opts.path);
+    if (!zts.node_is_running()) {
+      if (opts.key) {
+        zts.init_from_memory(opts.key);
+      }
+      if (opts.path) {
+        zts.init_from_storage(opts.path);
+      }
     }
     if (opts.eventListener) {
       onEvent = opts.eventListener;
@@ -57,8 +69,8 @@ export async function start(opts?: NodeStartOpts): Promise<string> {
   }
 
   state = NodeState.STARTED;
-  zts.node_start((event) => {
-    onEvent(event);
+  zts.node_start((event, peer) => {
+    onEvent(event, peer);
   });
   if (opts && opts.ref === true) zts.ref();
 
@@ -130,3 +142,85 @@ export function getIPv6Address(nwid: string) {
   }
   return zts.addr_get_str(nwid, true);
 }
+
+// STATS
+
+let statsNames: string[] | undefined;
+
+/**
+ * Names of lwIP's counters, in the order of the values returned by `stats`, e.g. "tcp.drop" or "memp.PBUF_POOL.max".
+ * Empty unless the binding was built with the LWIP_RUNTIME_STATS option (or as a debug build).
+ */
+export function getStatsNames(): string[] {
+  if (!statsNames) statsNames = zts.stats_names();
+  return statsNames;
+}
+
+/**
+ * Snapshots lwIP's counters, including usage and high-water marks of every memory pool. Pass the array of a previous
+ * call to reuse it, polling then allocates nothing.
+ */
+export async function stats(into?: Float64Array): Promise<Float64Array> {
+  const out = into ?? new Float64Array(getStatsNames().length);
+  await zts.stats(out);
+  return out;
+}
+
+// PEERS
+
+/**
+ * Last known state of every peer, including whether it is reached directly or through a (slower) relay. Only peers
+ * libzt has reported an event for are known.
+ */
+export function getPeers(): PeerInfo[] {
+  if (state !== NodeState.STARTED) {
+    throw Error("Node was not started");
+  }
+  return zts.peer_list();
+}
+
+/**
+ * Queries the ZeroTier core for the current physical paths to a peer, as "address/port". A peer without paths can only
+ * be reached through a relay.
+ */
+export function getPeerPaths(id: string): string[] {
+  if (state !== NodeState.STARTED) {
+    throw Error("Node was not started");
+  }
+  return zts.peer_paths(id);
+}
+
+// METRICS
+
+/**
+ * Prometheus text exposition of the ZeroTier core's counters (packets in and out, errors, peer latency... when the
+ * core keeps them) and of every peer's state: latency, path count and whether it is reached through a relay.
+ */
+export function getMetrics(): string {
+  return zts.metrics();
+}
+
+/**
+ * The samples of getMetrics, parsed.
+ */
+export function getMetricsSnapshot(): Sample[] {
+  return parseMetrics(zts.metrics());
+}
+
+// LATENCY
+
+/**
+ * Switches recording of latency histograms on or off, off by default. They cover the two queues most operations cross:
+ * commands posted to lwIP's tcpip thread and results delivered back to the js thread. While on, every crossing reads
+ * the clock and updates a few atomic counters; the `dispatch` benchmark with `latency` measures what that costs.
+ */
+export function setLatencyTracking(enable: boolean) {
+  zts.latency_enable(enable);
+}
+
+/**
+ * Snapshots the latency histograms, durations are in ns. With `reset`, recording starts over after the snapshot.
+ */
+export function getLatencyHistograms(reset = false): LatencyHistograms {
+  return zts.latency_histograms(reset);
+}
@@ -0,0 +1,139 @@
+/**
+ * Reader for the receive ring a UDP socket writes to in ring mode (see dgram.Socket.setRing). The ring lives in a
+ * SharedArrayBuffer, so it can be passed to and read from a worker. This module doesn't load the native binding.
+ *
+ * Layout: a header of int32 fields followed by `capacity` bytes of records, each record consisting of the payload
+ * length (uint32), the source address in binary representation (17 bytes), padding, the source port (uint16 at offset
+ * 22) and the payload, padded to a multiple of 4 bytes.
+ */
+
+const HEAD = 0;
+const TAIL = 1;
+const DROPPED = 2;
+const CAPACITY = 3;
+const SEQ = 4;
+const WAITING = 5;
+const HEADER_LEN = 64;
+const RECORD_HEADER_LEN = 24;
+const WRAP = 0xffffffff;
+
+export class RecvRing {
+  readonly buffer: SharedArrayBuffer;
+  readonly capacity: number;
+
+  private header: Int32Array;
+  private bytes: Uint8Array;
+  private words: Uint32Array;
+  private halves: Uint16Array;
+
+  /**
+   * @param capacity size of the record area in bytes, rounded up to a multiple of 4
+   * @param buffer an existing ring, e.g. one received from another thread. capacity is then ignored.
+   */
+  constructor(capacity: number, buffer?: SharedArrayBuffer) {
+    if (!buffer) {
+      capacity = Math.ceil(capacity / 4) * 4;
+      buffer = new SharedArrayBuffer(HEADER_LEN + capacity);
+      new Int32Array(buffer)[CAPACITY] = capacity;
+    }
+    this.buffer = buffer;
+    this.header = new Int32Array(buffer, 0, HEADER_LEN / 4);
+    this.capacity = this.header[CAPACITY];
+    this.bytes = new Uint8Array(buffer, HEADER_LEN, this.capacity);
+    this.words = new Uint32Array(buffer, HEADER_LEN, this.capacity / 4);
+    this.halves = new Uint16Array(buffer, HEADER_LEN, this.capacity / 2);
+  }
+
+  /** Number of datagrams dropped because the ring was full. */
+  get dropped(): number {
+    return Atomics.load(this.header, DROPPED);
+  }
+
+  /**
+   * Calls `onMessage` for every datagram in the ring and frees their space afterwards, the views passed to it are only
+   * valid during the call.
+   *
+   * @param max maximum number of datagrams to read
+   * @returns the number of datagrams read
+   */
+  poll(
+    onMessage: (data: Uint8Array, address: Uint8Array, port: number) => void,
+    max = Infinity,
+  ): number {
+    const head = Atomics.load(this.header, HEAD);
+    let tail = Atomics.load(this.header, TAIL);
+    let count = 0;
+
+    while (tail !== head && count < max) {
+      const length = this.words[tail / 4];
+      if (length === WRAP) {
+        tail = 0;
+        Atomics.store(this.header, TAIL, tail);
+        continue;
+      }
+      const start = tail + RECORD_HEADER_LEN;
+      onMessage(
+        this.bytes.subarray(start, start + length),
+        this.bytes.subarray(tail + 4, tail + 21),
+        this.halves[(tail + 22) / 2],
+      );
+      count++;
+
+      tail = (start + length + 3) & ~3;
+      if (tail === this.capacity) tail = 0;
+      Atomics.store(this.header, TAIL, tail);
+    }
+    return count;
+  }
+
+  /**
+   * Blocks until the ring is not empty or `timeout` ms have passed. Only use this from a worker: the wakeup is sent by
+   * the thread that owns the socket, blocking that thread itself never wakes up before the timeout.
+   *
+   * @returns false if the timeout expired with the ring still empty
+   */
+  wait(timeout = Infinity): boolean {
+    const seq = Atomics.load(this.header, SEQ);
+    Atomics.store(this.header, WAITING, 1);
+    let result = true;
+    if (Atomics.load(this.header, HEAD) === Atomics.load(this.header, TAIL))
+      result = Atomics.wait(this.header, SEQ, seq, timeout) !== "timed-out";
+    Atomics.store(this.header, WAITING, 0);
+    return result;
+  }
+
+  /** Wakes up readers blocked in wait, called by the socket. */
+  notify() {
+    Atomics.notify(this.header, SEQ);
+  }
+}
+
+/**
+ * Formats an address in binary representation, as passed to RecvRing.poll's callback.
+ */
+export function formatAddress(address: Uint8Array): string {
+  if (address[16] === 4) return address.subarray(0, 4).join(".");
+
+  const groups: number[] = [];
+  for (let i = 0; i < 16; i += 2)
+    groups.push((address[i] << 8) | address[i + 1]);
+
+  // compress the longest run of zero groups
+  let best = -1;
+  let bestLength = 1;
+  for (let i = 0; i < 8; ) {
+    let j = i;
+    while (j < 8 && groups[j] === 0) j++;
+    if (j - i > bestLength) {
+      best = i;
+      bestLength = j - i;
+    }
+    i = j === i ? i + 1 : j;
+  }
+
+  const hex = groups.map((group) => group.toString(16));
+  if (best < 0) return hex.join(":");
+  const start = hex.slice(0, best).join(":");
+  const end = hex.slice(best + bestLength).join(":");
+  return `${start}::${end}`;
+}
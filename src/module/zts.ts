@@ -11,12 +11,26 @@ export declare class InternalSocket {
   constructor();
   setEmitter(emit: (event: string, ...args: unknown[]) => boolean): void;
   connect(port: number, address: string): void;
-  ack(length: number): void;
-  send(data: Uint8Array): Promise<number>;
+  read(size: number): Uint8Array[] | null | undefined;
+  send(data: Uint8Array, noCopy?: boolean): Promise<void>;
+  sendv(chunks: Uint8Array[], noCopy?: boolean): Promise<void>;
+  queued(): number;
   shutdown_wr(): void;
   ref(): void;
   unref(): void;
   nagle(enable: boolean): void;
+  zeroCopyRecv(enable: boolean): void;
+  recvChunkSize(size: number): void;
+  recvBuffer(size: number, max: number): void;
+  recvBudget(bytes: number, packets: number): void;
+  setTimeout(timeout: number): void;
+  keepAlive(
+    enable: boolean,
+    idle: number,
+    interval: number,
+    count: number,
+  ): void;
+  getInfo(out: Float64Array): Promise<void>;
 }
 
 export declare class InternalServer {
@@ -24,6 +38,8 @@ export declare class InternalServer {
   close(): Promise<void>;
   ref(): void;
   unref(): void;
+  maxConnections(max: number): void;
+  connectionsInfo(out: Float64Array, addresses: Uint8Array): Promise<number>;
 }
 
 declare class UDP {
@@ -32,16 +48,49 @@ declare class UDP {
     recvCallback: (data: Uint8Array, addr: string, port: number) => void,
   );
 
-  send(data: Uint8Array, addr: string, port: number): Promise<void>;
-  bind(addr: string, port: number): Promise<void>;
+  send(
+    data: Uint8Array,
+    addr: string | Uint8Array,
+    port: number,
+  ): Promise<void>;
+  sendMany(
+    data: Uint8Array,
+    table: Uint32Array,
+    addresses: string[] | Uint8Array,
+  ): Promise<Int32Array>;
+  sendSegments(
+    data: Uint8Array,
+    segmentSize: number,
+    addr: string | Uint8Array,
+    port: number,
+  ): Promise<void>;
+  bind(addr: string, port: number, reusePort?: boolean): Promise<void>;
   close(): Promise<void>;
 
   address(): { port: number; address: string; family: "udp6" | "udp4" };
   remoteAddress(): { port: number; address: string; family: "udp6" | "udp4" };
 
-  connect(addr: string, port: number): Promise<void>;
+  connect(addr: string | Uint8Array, port: number): Promise<void>;
   disconnect(): void;
 
+  addMembership(group: string, iface?: string): Promise<void>;
+  dropMembership(group: string, iface?: string): Promise<void>;
+  setMulticastInterface(iface: string): Promise<void>;
+  setMulticastTTL(ttl: number): void;
+  setMulticastLoopback(enable: boolean): void;
+
+  recvBudget(bytes: number, packets: number): void;
+  dropped(): number;
+  setBatchCallback(
+    callback: (
+      data: Uint8Array,
+      table: Uint32Array,
+      addresses: string[] | Uint8Array,
+    ) => void,
+  ): void;
+  binaryAddresses(enable: boolean): void;
+  setRing(view: Uint8Array, notify: () => void): void;
+
   ref(): void;
   unref(): void;
 }
@@ -55,14 +104,55 @@ export interface AddrInfo {
   remoteFamily: "IPv4" | "IPv6";
 }
 
+/**
+ * Log-linear histogram of durations in ns. `counts[i]` is the number of values in bucket i, which starts at `i` for
+ * i < 8 and at `(8 + i % 8) << (i / 8 - 1)` (integer division) otherwise. Percentiles are upper bounds of buckets.
+ */
+export interface LatencyHistogram {
+  count: number;
+  sum: number;
+  max: number;
+  p50: number;
+  p90: number;
+  p99: number;
+  p999: number;
+  counts: Float64Array;
+}
+
+export interface LatencyHistograms {
+  /** time commands wait before the tcpip thread runs them */
+  tcpipWait: LatencyHistogram;
+  /** time the tcpip thread spends on a single command */
+  tcpipBusy: LatencyHistogram;
+  /** time from waking up the js thread to it handling completed operations */
+  completionWait: LatencyHistogram;
+}
+
+/**
+ * Last known state of a peer, as reported by libzt's peer events.
+ */
+export interface PeerInfo {
+  /** node id, 10 hex digits */
+  id: string;
+  role: "leaf" | "moon" | "planet";
+  /** latency of the best path in ms, -1 if unknown */
+  latency: number;
+  pathCount: number;
+  /** physical paths as "address/port" */
+  paths: string[];
+  /** whether the peer was last reached directly or through a relay */
+  reachability: "direct" | "relay" | "unreachable" | "unknown";
+}
+
 type ZTS = {
   init_from_storage(path: string): void;
   init_from_memory(key: Uint8Array): void;
 
-  node_start(callback: (event: number) => void): void;
+  node_start(callback: (event: number, peer?: PeerInfo) => void): void;
 
   node_is_online(): boolean;
   node_get_id(): string;
+  node_is_running(): boolean;
   node_free(): void;
 
   ref(): void;
@@ -73,6 +163,19 @@ type ZTS = {
   net_transport_is_ready(nwid: string): boolean;
 
   addr_get_str(nwid: string, ipv6: boolean): string;
+  addr_parse(addr: string): Uint8Array | undefined;
+  addr_format(bin: Uint8Array, index: number): string;
+
+  stats_names(): string[];
+  stats(out: Float64Array): Promise<void>;
+
+  peer_list(): PeerInfo[];
+  peer_paths(id: string): string[];
+
+  metrics(): string;
+
+  latency_enable(enable: boolean): void;
+  latency_histograms(reset: boolean): LatencyHistograms;
 
   UDP: new (
     ipv6: boolean,
@@ -83,14 +186,20 @@ type ZTS = {
     createServer(
       port: number,
       address: string,
+      backlog: number,
+      reusePort: boolean,
       onConnection: (
         error: InternalError | undefined,
-        socket: InternalSocket,
-        addrInfo: AddrInfo,
+        sockets: InternalSocket[],
+        addrInfos: AddrInfo[],
+        dropped: number,
       ) => void,
     ): Promise<InternalServer>;
   };
-  Socket: new () => InternalSocket;
+  Socket: {
+    new (): InternalSocket;
+    infoFields(): string[];
+  };
 };
 
 import * as loadBinding from "pkg-prebuilds";
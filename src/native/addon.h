@@ -0,0 +1,51 @@
+#ifndef ADDON_DATA
+#define ADDON_DATA
+
+#include "lwip-util.h"
+#include "macros.h"
+#include "napi.h"
+
+#include <memory>
+
+/**
+ * State of the addon in a single js environment, the main thread or a worker thread. Everything that holds js values or
+ * calls into js lives here, while libzt and the lwip stack underneath are shared by all environments of the process.
+ *
+ * Created when the addon is loaded into an environment and freed when the environment is torn down.
+ */
+struct AddonData {
+    std::shared_ptr<CompletionChannel> completions = std::make_shared<CompletionChannel>();
+    AddressCache address_cache;
+
+    // class constructors
+    Napi::FunctionReference tcp_socket;
+    Napi::FunctionReference tcp_server;
+    Napi::FunctionReference udp_socket;
+
+    // this environment's listener for libzt's events, set by node_start
+    Napi::ThreadSafeFunction* event_callback = nullptr;
+
+    AddonData(Napi::Env env)
+    {
+        completions->init(env);
+        // cleanup hooks run in reverse order of registration, so this runs before the channel's tsfn is torn down
+        env.AddCleanupHook([completions = completions]() { completions->close(); });
+    }
+};
+
+AddonData& addon_data(Napi::Env env)
+{
+    return *env.GetInstanceData<AddonData>();
+}
+
+std::shared_ptr<CompletionChannel> completion_channel(Napi::Env env)
+{
+    return addon_data(env).completions;
+}
+
+AddressCache& address_cache(Napi::Env env)
+{
+    return addon_data(env).address_cache;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * Native benchmark of the dispatcher (dispatch.h) that carries every command of the binding to the lwip tcpip thread,
+ * without node or a ZeroTier network. Every result is printed as one JSON object per line.
+ *
+ * The socket paths aren't benchmarked here: their logic lives in the binding's napi classes, so measuring them on raw
+ * lwip would only measure lwip. src/test/bench.ts benchmarks them through the binding.
+ *
+ * usage: nodezt_bench [benchmark ...]   runs all benchmarks if none are given
+ *
+ * Built with the NODEZT_BENCH CMake option.
+ */
+
+#include "dispatch.h"
+#include "histogram.h"
+#include "lwip/tcpip.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+
+constexpr int dispatch_count = 5'000'000;
+constexpr int dispatch_rounds = 100'000;
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// runs `f` in the tcpip thread and waits for its result
+template <typename F> auto run_sync(F f)
+{
+    std::promise<decltype(f())> promise;
+    auto future = promise.get_future();
+    tcpip_dispatcher.push([&]() {
+        if constexpr (std::is_void_v<decltype(f())>) {
+            f();
+            promise.set_value();
+        }
+        else {
+            promise.set_value(f());
+        }
+    });
+    return future.get();
+}
+
+void start_stack()
+{
+    std::promise<void> started;
+    tcpip_init([](void* arg) { reinterpret_cast<std::promise<void>*>(arg)->set_value(); }, &started);
+    started.get_future().wait();
+}
+
+void report(const char* bench, std::vector<std::pair<const char*, double> > values)
+{
+    std::printf("{\"bench\":\"%s\"", bench);
+    for (auto& [name, value] : values) {
+        std::printf(",\"%s\":%.6g", name, value);
+    }
+    std::printf("}\n");
+    std::fflush(stdout);
+}
+
+/**
+ * Cost of typed_tcpip_callback's dispatcher: throughput of dispatch_count empty commands pushed back to back, and the
+ * round trip latency of dispatch_rounds commands each waited for.
+ */
+void dispatch()
+{
+    std::atomic<int> executed = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < dispatch_count; i++) {
+        tcpip_dispatcher.push([&executed]() { executed.fetch_add(1, std::memory_order_relaxed); });
+    }
+    run_sync([]() {});
+    double seconds = seconds_since(start);
+
+    LatencyHistogram latency;
+    for (int i = 0; i < dispatch_rounds; i++) {
+        auto sent_at = Clock::now();
+        run_sync([]() {});
+        latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent_at).count());
+    }
+    LatencyHistogram::Snapshot snapshot;
+    latency.snapshot(snapshot, false);
+
+    report("dispatch", { { "count", (double)executed },
+                         { "seconds", seconds },
+                         { "nsPerOp", seconds * 1e9 / dispatch_count },
+                         { "roundTripAvgUs", snapshot.sum / 1e3 / snapshot.total },
+                         { "roundTripP50Us", snapshot.percentile(0.5) / 1e3 },
+                         { "roundTripP99Us", snapshot.percentile(0.99) / 1e3 } });
+}
+
+int main(int argc, char** argv)
+{
+    std::map<std::string, void (*)()> benchmarks = {
+        { "dispatch", dispatch },
+    };
+
+    std::vector<std::string> selected(argv + 1, argv + argc);
+    for (auto& name : selected) {
+        if (benchmarks.find(name) == benchmarks.end()) {
+            std::fprintf(stderr, "unknown benchmark %s, available:", name.c_str());
+            for (auto& [available, _] : benchmarks) {
+                std::fprintf(stderr, " %s", available.c_str());
+            }
+            std::fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+    if (selected.empty()) {
+        for (auto& [name, _] : benchmarks) {
+            selected.push_back(name);
+        }
+    }
+
+    start_stack();
+    for (auto& name : selected) {
+        benchmarks[name]();
+    }
+    return 0;
+}
@@ -1,10 +1,20 @@
 #include "ZeroTierSockets.h"
+#include "addon.h"
 #include "macros.h"
+#include "metrics.h"
+#include "stats.h"
 #include "tcp.cc"
 #include "udp.cc"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <napi.h>
+#include <optional>
 #include <sstream>
+#include <vector>
 
 #define THROW_ERROR(ERR, FUN)                                                                                          \
     do {                                                                                                               \
@@ -36,29 +46,98 @@ VOID_METHOD(init_from_memory)
 
 // ### event and lifetime ###
 
-Napi::ThreadSafeFunction* event_callback = nullptr;
+#define EVENT_QUEUE_SIZE 256
 
-void event_handler(void* msgPtr)
+/**
+ * libzt's node is shared by every environment (main thread or worker) that started it. Each of them registers an event
+ * callback, the node is freed once the last one is gone.
+ */
+std::mutex node_mutex;
+// protected by node_mutex
+std::vector<Napi::ThreadSafeFunction*> event_callbacks;
+bool node_running = false;
+
+Napi::Object peer_to_js(Napi::Env env, uint64_t id, const PeerTable::Peer& peer)
 {
-    if (! event_callback) {
-        return;
+    auto paths = Napi::Array::New(env, peer.paths.size());
+    for (uint32_t i = 0; i < peer.paths.size(); i++) {
+        paths[i] = STRING(peer.paths[i]);
     }
 
+    const char* reachability = peer.reachability == ZTS_EVENT_PEER_DIRECT  ? "direct"
+                               : peer.reachability == ZTS_EVENT_PEER_RELAY ? "relay"
+                               : peer.reachability == ZTS_EVENT_PEER_UNREACHABLE ? "unreachable"
+                                                                                 : "unknown";
+    const char* role = peer.role == ZTS_PEER_ROLE_PLANET ? "planet" : peer.role == ZTS_PEER_ROLE_MOON ? "moon" : "leaf";
+
+    return OBJECT({
+        ADD_FIELD("id", STRING(node_id_to_string(id)));
+        ADD_FIELD("role", STRING(role));
+        ADD_FIELD("latency", NUMBER(peer.latency));
+        ADD_FIELD("pathCount", NUMBER(peer.path_count));
+        ADD_FIELD("paths", paths);
+        ADD_FIELD("reachability", STRING(reachability));
+    });
+}
+
+void event_handler(void* msgPtr)
+{
     zts_event_msg_t* msg = reinterpret_cast<zts_event_msg_t*>(msgPtr);
     int event = msg->event_code;
-    auto cb = [event](TSFN_ARGS) { jsCallback.Call({ NUMBER(event) }); };
 
-    int status = event_callback->BlockingCall(cb);
+    // peer events carry the peer's state, copied because msg is gone by the time js runs
+    std::optional<std::pair<uint64_t, PeerTable::Peer> > peer;
+    if (event >= ZTS_EVENT_PEER_DIRECT && event <= ZTS_EVENT_PEER_PATH_DEAD && msg->peer)
+        peer.emplace(msg->peer->peer_id, peer_table.update(event, msg->peer));
+
+    auto cb = [event, peer](TSFN_ARGS) {
+        if (peer)
+            jsCallback.Call({ NUMBER(event), peer_to_js(env, peer->first, peer->second) });
+        else
+            jsCallback.Call({ NUMBER(event) });
+    };
+
+    // acquired so they can't be finalised while this thread is blocked on one of them without holding the lock
+    std::vector<Napi::ThreadSafeFunction> callbacks;
+    {
+        std::lock_guard lock(node_mutex);
+        for (auto callback : event_callbacks) {
+            if (callback->Acquire() == napi_ok)
+                callbacks.push_back(*callback);
+        }
+    }
 
-    if (status != napi_ok) {
-        event_callback = nullptr;
+    for (auto& callback : callbacks) {
+        // an aborted tsfn must not be used anymore, not even to release it
+        if (callback.BlockingCall(cb) == napi_ok)
+            callback.Release();
     }
 }
 
+/**
+ * Removes `callback` from the registered event callbacks.
+ *
+ * @returns whether it was the last one, the node then has to be freed
+ */
+bool detach_event_callback(Napi::ThreadSafeFunction* callback)
+{
+    std::lock_guard lock(node_mutex);
+    auto it = std::find(event_callbacks.begin(), event_callbacks.end(), callback);
+    if (it == event_callbacks.end())
+        return false;
+    event_callbacks.erase(it);
+
+    if (! event_callbacks.empty() || ! node_running)
+        return false;
+    node_running = false;
+    return true;
+}
+
 VOID_METHOD(ref)
 {
     NO_ARGS();
 
+    auto event_callback = addon_data(env).event_callback;
     if (event_callback)
         event_callback->Ref(env);
 }
@@ -66,6 +145,8 @@ VOID_METHOD(ref)
 VOID_METHOD(unref)
 {
     NO_ARGS();
+
+    auto event_callback = addon_data(env).event_callback;
     if (event_callback)
         event_callback->Unref(env);
 }
@@ -78,6 +159,9 @@ VOID_METHOD(unref)
  *
  * If node_free is explicitly called, the tsfn is aborted and in its finaliser the actual node is freed.
  *
+ * If another environment already started the node, this environment attaches to it: it receives the node's events
+ * from now on and the node is only freed once every environment has freed it.
+ *
  * @param cb { (event: number) => void } Callback that is called for every event.
  */
 VOID_METHOD(node_start)
@@ -86,34 +170,63 @@ VOID_METHOD(node_start)
     auto cb = ARG_FUNC(0);
     int err;
 
-    event_callback = [&] {
+    // held until the callback is registered, so libzt's event thread can't run event_handler before that
+    std::lock_guard lock(node_mutex);
+    if (! node_running) {
+        // nothing is registered yet, a failed start leaves no callback behind
+        err = zts_init_set_event_handler(&event_handler);
+        THROW_ERROR(err, "node_start:set_event_handler");
+
+        err = zts_node_start();
+        THROW_ERROR(err, "node_start");
+
+        node_running = true;
+    }
+
+    auto event_callback = [&] {
         auto tsfn = new Napi::ThreadSafeFunction;
-        *tsfn = Napi::ThreadSafeFunction::New(env, cb, "zts_event_listener", 0, 1, [tsfn](Napi::Env) {
+        // bounded, so libzt's event thread blocks in event_handler instead of queueing without limit
+        *tsfn = Napi::ThreadSafeFunction::New(env, cb, "zts_event_listener", EVENT_QUEUE_SIZE, 1, [tsfn](Napi::Env) {
+            bool last = detach_event_callback(tsfn);
             delete tsfn;
-            zts_node_free();
+            if (last)
+                zts_node_free();
         });
         return tsfn;
     }();
     event_callback->Unref(env);
-
-    err = zts_init_set_event_handler(&event_handler);
-    THROW_ERROR(err, "node_start:set_event_handler");
-
-    err = zts_node_start();
-    THROW_ERROR(err, "node_start");
+    addon_data(env).event_callback = event_callback;
+    event_callbacks.push_back(event_callback);
 }
 
 VOID_METHOD(node_free)
 {
     NO_ARGS();
 
+    auto& data = addon_data(env);
+    auto event_callback = data.event_callback;
+    data.event_callback = nullptr;
+    if (! event_callback)
+        return;
+
+    bool last = detach_event_callback(event_callback);
+    // libzt's event thread may be blocked on a full event queue
+    event_callback->Abort();
+    if (! last)
+        return;
+
     int err = zts_node_free();
     THROW_ERROR(err, "node_free");
+}
 
-    if (event_callback) {
-        event_callback->Abort();
-        event_callback = nullptr;
-    }
+/**
+ * @returns { boolean } whether the node has been started, possibly by another environment
+ */
+METHOD(node_is_running)
+{
+    NO_ARGS();
+    std::lock_guard lock(node_mutex);
+    return BOOL(node_running);
 }
 
 METHOD(node_is_online)
@@ -185,10 +298,206 @@ METHOD(addr_get_str)
     return STRING(addr);
 }
 
+/**
+ * @param addr { string }
+ * @returns { Uint8Array | undefined } the address in binary representation, undefined if it isn't a valid address
+ */
+METHOD(addr_parse)
+{
+    NB_ARGS(1);
+    ip_addr_t addr;
+    if (! parse_addr(ARG_STRING(0), &addr))
+        return UNDEFINED;
+
+    auto bin = addr_to_binary(&addr);
+    auto result = Napi::Uint8Array::New(env, BINARY_ADDR_LEN);
+    std::memcpy(result.Data(), bin.data(), BINARY_ADDR_LEN);
+    return result;
+}
+
+/**
+ * @param bin { Uint8Array } address in binary representation
+ * @param offset { number } index of the address in `bin`, for packed addresses
+ * @returns { string }
+ */
+METHOD(addr_format)
+{
+    NB_ARGS(2);
+    auto bin = ARG_UINT8ARRAY(0);
+    size_t offset = ARG_NUMBER(1).Int64Value() * BINARY_ADDR_LEN;
+    if (offset + BINARY_ADDR_LEN > bin.ByteLength())
+        throw Napi::RangeError::New(env, "Address out of range");
+
+    ip_addr_t addr;
+    if (! binary_to_addr(bin.Data() + offset, &addr))
+        throw Napi::TypeError::New(env, "Invalid address");
+    return address_cache(env).get(env, &addr);
+}
+
+// ### stats ###
+
+/**
+ * @returns { string[] } names of the values in a stats snapshot, empty if lwip was built without statistics
+ */
+METHOD(stats_names)
+{
+    NO_ARGS();
+    auto names = lwip_stats_names();
+    auto result = Napi::Array::New(env, names.size());
+    for (uint32_t i = 0; i < names.size(); i++) {
+        result[i] = STRING(names[i]);
+    }
+    return result;
+}
+
+/**
+ * Snapshots lwip's statistics in the tcpip thread, directly into `out`, so polling allocates nothing.
+ *
+ * @param out { Float64Array } with room for a value per name returned by stats_names
+ * @returns { Promise<void> } resolves once `out` holds the snapshot
+ */
+METHOD(stats)
+{
+    NB_ARGS(1);
+    auto out = info[0].As<Napi::Float64Array>();
+    static const size_t count = lwip_stats_names().size();
+    if (out.ElementLength() < count)
+        throw Napi::RangeError::New(env, "Stats array too small");
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once_void(
+            env, [data = out.Data()]() { lwip_stats_snapshot(data); },
+            [outRef = ref_value(out), promise](COMPLETION_ARGS) {
+                outRef->Reset();
+                promise->Resolve(UNDEFINED);
+            }));
+    });
+}
+
+// ### peers ###
+
+/**
+ * @returns { PeerInfo[] } last known state of every peer libzt reported an event for
+ */
+METHOD(peer_list)
+{
+    NO_ARGS();
+    auto result = Napi::Array::New(env);
+    uint32_t i = 0;
+    peer_table.for_each([&](uint64_t id, const PeerTable::Peer& peer) { result[i++] = peer_to_js(env, id, peer); });
+    return result;
+}
+
+/**
+ * Queries the core for the peer's current physical paths.
+ *
+ * @param id { string } peer's node id
+ * @returns { string[] } paths as "address/port"
+ */
+METHOD(peer_paths)
+{
+    NB_ARGS(1);
+    std::string peer_id = ARG_STRING(0);
+
+    char* end = nullptr;
+    errno = 0;
+    uint64_t id = std::strtoull(peer_id.c_str(), &end, 16);
+    if (peer_id.empty() || *end != '\0' || errno == ERANGE)
+        throw Napi::TypeError::New(env, "Invalid peer id");
+
+    std::vector<std::string> paths;
+    int err = zts_core_lock_obtain();
+    THROW_ERROR(err, "core_lock_obtain");
+    int count = zts_core_query_path_count(id);
+    for (int i = 0; i < count; i++) {
+        char path[ZTS_IP_MAX_STR_LEN + 8] = "";
+        if (zts_core_query_path(id, i, path, sizeof(path)) == ZTS_ERR_OK)
+            paths.push_back(path);
+    }
+    zts_core_lock_release();
+    THROW_ERROR(count, "core_query_path_count");
+
+    auto result = Napi::Array::New(env, paths.size());
+    for (uint32_t i = 0; i < paths.size(); i++) {
+        result[i] = STRING(paths[i]);
+    }
+    return result;
+}
+
+// ### metrics ###
+
+/**
+ * @returns { string } Prometheus text exposition of the ZeroTier core's counters and the state of every peer
+ */
+METHOD(metrics)
+{
+    NO_ARGS();
+    return STRING(metrics_text());
+}
+
+// ### latency ###
+
+/**
+ * Switches recording of the dispatch and completion latency histograms on or off.
+ *
+ * @param enable { boolean }
+ */
+VOID_METHOD(latency_enable)
+{
+    NB_ARGS(1);
+    latency_stats.enabled = ARG_BOOLEAN(0);
+}
+
+Napi::Object histogram_to_js(Napi::Env env, LatencyHistogram& histogram, bool reset)
+{
+    auto snapshot = std::make_unique<LatencyHistogram::Snapshot>();
+    histogram.snapshot(*snapshot, reset);
+
+    // counts up to the last non-empty bucket, bucket i starts at LatencyHistogram::lower_bound(i)
+    size_t used = LatencyHistogram::buckets;
+    while (used > 0 && snapshot->counts[used - 1] == 0)
+        used--;
+    auto counts = Napi::Float64Array::New(env, used);
+    for (size_t i = 0; i < used; i++) {
+        counts[i] = snapshot->counts[i];
+    }
+
+    return OBJECT({
+        ADD_FIELD("count", NUMBER(snapshot->total));
+        ADD_FIELD("sum", NUMBER(snapshot->sum));
+        ADD_FIELD("max", NUMBER(snapshot->max));
+        ADD_FIELD("p50", NUMBER(snapshot->percentile(0.5)));
+        ADD_FIELD("p90", NUMBER(snapshot->percentile(0.9)));
+        ADD_FIELD("p99", NUMBER(snapshot->percentile(0.99)));
+        ADD_FIELD("p999", NUMBER(snapshot->percentile(0.999)));
+        ADD_FIELD("counts", counts);
+    });
+}
+
+/**
+ * Snapshots the latency histograms, all durations are in ns.
+ *
+ * @param reset { boolean } start over after the snapshot, e.g. to get the latency of every polling interval
+ * @returns { Record<"tcpipWait" | "tcpipBusy" | "completionWait", Histogram> }
+ */
+METHOD(latency_histograms)
+{
+    NB_ARGS(1);
+    bool reset = ARG_BOOLEAN(0);
+
+    return OBJECT({
+        ADD_FIELD("tcpipWait", histogram_to_js(env, latency_stats.tcpip_wait, reset));
+        ADD_FIELD("tcpipBusy", histogram_to_js(env, latency_stats.tcpip_busy, reset));
+        ADD_FIELD("completionWait", histogram_to_js(env, latency_stats.completion_wait, reset));
+    });
+}
+
 // NAPI initialiser
 
 INIT_ADDON(zts)
 {
+    env.SetInstanceData(new AddonData(env));
+
     // init
     EXPORT_FUNCTION(init_from_storage);
     EXPORT_FUNCTION(init_from_memory);
@@ -201,6 +510,7 @@ INIT_ADDON(zts)
     EXPORT_FUNCTION(node_free);
     EXPORT_FUNCTION(node_is_online);
     EXPORT_FUNCTION(node_get_id);
+    EXPORT_FUNCTION(node_is_running);
 
     // net
     EXPORT_FUNCTION(net_join);
@@ -209,6 +519,17 @@ INIT_ADDON(zts)
 
     // addr
     EXPORT_FUNCTION(addr_get_str);
+    EXPORT_FUNCTION(addr_parse);
+    EXPORT_FUNCTION(addr_format);
+
+    // stats
+    EXPORT_FUNCTION(stats_names);
+    EXPORT_FUNCTION(stats);
+    EXPORT_FUNCTION(peer_list);
+    EXPORT_FUNCTION(peer_paths);
+    EXPORT_FUNCTION(metrics);
+    EXPORT_FUNCTION(latency_enable);
+    EXPORT_FUNCTION(latency_histograms);
 
     INIT_CLASS(TCP::Socket);
     INIT_CLASS(TCP::Server);
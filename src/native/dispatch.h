@@ -0,0 +1,188 @@
+#ifndef TCPIP_DISPATCH
+#define TCPIP_DISPATCH
+
+#include "histogram.h"
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Fixed-size command record. Callables that fit into `storage` are constructed in place, larger ones are moved to the
+ * heap and only their pointer is stored. `run` executes the callable and destroys it.
+ */
+struct Command {
+    static constexpr size_t inline_size = 96;
+
+    void (*run)(Command*);
+    // when the command was pushed, 0 unless latency_stats is on
+    uint64_t queued_at;
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+
+    template <typename F> void set(F&& f)
+    {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= inline_size && alignof(T) <= alignof(std::max_align_t)) {
+            new (storage) T(std::forward<F>(f));
+            run = [](Command* cmd) {
+                auto t = std::launder(reinterpret_cast<T*>(cmd->storage));
+                (*t)();
+                t->~T();
+            };
+        }
+        else {
+            *reinterpret_cast<T**>(storage) = new T(std::forward<F>(f));
+            run = [](Command* cmd) {
+                auto t = *reinterpret_cast<T**>(cmd->storage);
+                (*t)();
+                delete t;
+            };
+        }
+    }
+};
+
+/**
+ * Bounded multi-producer ring of commands that are executed in the lwip tcpip thread. Instead of posting one mbox
+ * message per command, the first command pushed into an idle ring posts a single preallocated callback message which
+ * runs every pending command in one visit to the tcpip thread.
+ *
+ * The ring is a sequence-numbered array (D. Vyukov's bounded queue), pushing is lock-free as long as there is room. When
+ * the ring is full the producer yields until the tcpip thread has made room, like tcpip_callback blocks on a full mbox.
+ * Commands are executed in the order in which they were pushed. The tcpip thread itself must never push, it would wait
+ * for room only it can make.
+ */
+class TcpipDispatcher {
+  public:
+    static constexpr size_t capacity = 1024;
+
+    TcpipDispatcher()
+    {
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename F> void push(F&& f)
+    {
+        LWIP_ASSERT("tcpip_dispatcher.push called from the tcpip thread",
+                    std::this_thread::get_id() != tcpip_thread.load(std::memory_order_relaxed));
+
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & (capacity - 1)];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                // full, make sure the tcpip thread is on its way and wait for it to make room
+                schedule();
+                std::this_thread::yield();
+                pos = tail.load(std::memory_order_relaxed);
+            }
+            else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->cmd.set(std::forward<F>(f));
+        cell->cmd.queued_at = latency_stats.on() ? LatencyStats::now() : 0;
+        cell->seq.store(pos + 1, std::memory_order_release);
+
+        schedule();
+    }
+
+  private:
+    struct alignas(64) Cell {
+        std::atomic<size_t> seq;
+        Command cmd;
+    };
+
+    Cell cells[capacity];
+    alignas(64) std::atomic<size_t> tail = 0;
+    // only accessed in the tcpip thread
+    alignas(64) size_t head = 0;
+    std::atomic<bool> scheduled = false;
+    // set by the first drain, only used to catch pushes from the tcpip thread
+    std::atomic<std::thread::id> tcpip_thread {};
+
+    std::once_flag msg_once;
+    tcpip_callback_msg* msg = nullptr;
+
+    static void drain_cb(void* ctx)
+    {
+        reinterpret_cast<TcpipDispatcher*>(ctx)->drain();
+    }
+
+    // in producer threads, may block until the tcpip thread's mbox has room
+    void schedule()
+    {
+        if (scheduled.exchange(true, std::memory_order_acq_rel))
+            return;
+
+        // lwip's memory pools only exist once the stack has been started, so the message is allocated on first use
+        std::call_once(msg_once, [this]() { msg = tcpip_callbackmsg_new(drain_cb, this); });
+
+        // only one drain is ever scheduled at a time, so the preallocated message is never posted twice
+        if (msg == nullptr || tcpip_callbackmsg_trycallback(msg) != ERR_OK) {
+            tcpip_callback(drain_cb, this);
+        }
+    }
+
+    // in lwip tcpip thread, like schedule but never blocks: a full mbox can only be emptied by this thread, so the next
+    // drain then runs from the thread's timeouts instead
+    void reschedule()
+    {
+        if (scheduled.exchange(true, std::memory_order_acq_rel))
+            return;
+
+        if (msg == nullptr || tcpip_callbackmsg_trycallback(msg) != ERR_OK) {
+            sys_timeout(0, drain_cb, this);
+        }
+    }
+
+    // in lwip tcpip thread
+    void drain()
+    {
+        tcpip_thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+        // commands pushed from here on schedule a new drain, reading the flag with acquire semantics makes every command
+        // pushed before the last schedule visible
+        scheduled.exchange(false, std::memory_order_acq_rel);
+
+        // run at most one ring's worth so producers can't keep the tcpip thread here forever
+        for (size_t n = 0; n < capacity; n++) {
+            Cell* cell = &cells[head & (capacity - 1)];
+            if (cell->seq.load(std::memory_order_acquire) != head + 1)
+                return;
+
+            if (cell->cmd.queued_at) {
+                uint64_t start = LatencyStats::now();
+                cell->cmd.run(&cell->cmd);
+                latency_stats.tcpip_wait.record(start - cell->cmd.queued_at);
+                latency_stats.tcpip_busy.record(LatencyStats::now() - start);
+            }
+            else {
+                cell->cmd.run(&cell->cmd);
+            }
+            cell->seq.store(head + capacity, std::memory_order_release);
+            head++;
+        }
+
+        reschedule();
+    }
+};
+
+TcpipDispatcher tcpip_dispatcher;
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef LATENCY_HISTOGRAM
+#define LATENCY_HISTOGRAM
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lock-free log-linear histogram of durations in ns, in the spirit of HdrHistogram: every power of two is split into
+ * `sub_buckets` linear buckets, so a recorded value is off by at most 1/8 no matter its magnitude. Recording is a
+ * handful of relaxed atomic increments and can be done from any thread.
+ */
+class LatencyHistogram {
+  public:
+    static constexpr unsigned sub_bits = 3;
+    static constexpr unsigned sub_buckets = 1 << sub_bits;
+    static constexpr size_t buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    void record(uint64_t ns)
+    {
+        counts[index(ns)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t prev = max.load(std::memory_order_relaxed);
+        while (ns > prev && ! max.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    static size_t index(uint64_t ns)
+    {
+        if (ns < sub_buckets)
+            return ns;
+        unsigned shift = std::bit_width(ns) - 1 - sub_bits;
+        return (shift + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+    }
+
+    // smallest value recorded in bucket `i`
+    static uint64_t lower_bound(size_t i)
+    {
+        if (i < sub_buckets)
+            return i;
+        unsigned shift = i / sub_buckets - 1;
+        return (uint64_t)(sub_buckets + i % sub_buckets) << shift;
+    }
+
+    // plain copy of the counters
+    struct Snapshot {
+        uint64_t counts[buckets];
+        uint64_t total;
+        uint64_t sum;
+        uint64_t max;
+
+        // upper end of the bucket holding the value at quantile `q`, 0 if nothing was recorded
+        uint64_t percentile(double q) const
+        {
+            if (total == 0)
+                return 0;
+            uint64_t rank = (uint64_t)(q * (total - 1)) + 1;
+            uint64_t seen = 0;
+            for (size_t i = 0; i < buckets; i++) {
+                seen += counts[i];
+                if (seen >= rank)
+                    return std::min<uint64_t>(i + 1 < buckets ? lower_bound(i + 1) - 1 : UINT64_MAX, max);
+            }
+            return max;
+        }
+    };
+
+    /**
+     * Copies the histogram to `out`, optionally resetting it. Values recorded concurrently may end up in either this
+     * snapshot or the next one.
+     */
+    void snapshot(Snapshot& out, bool reset)
+    {
+        for (size_t i = 0; i < buckets; i++) {
+            out.counts[i] = reset ? counts[i].exchange(0, std::memory_order_relaxed)
+                                  : counts[i].load(std::memory_order_relaxed);
+        }
+        out.total = reset ? total.exchange(0, std::memory_order_relaxed) : total.load(std::memory_order_relaxed);
+        out.sum = reset ? sum.exchange(0, std::memory_order_relaxed) : sum.load(std::memory_order_relaxed);
+        out.max = reset ? max.exchange(0, std::memory_order_relaxed) : max.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> counts[buckets] = {};
+    std::atomic<uint64_t> total = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+};
+
+/**
+ * Latency of the two queues crossed by most operations: commands posted to the lwip tcpip thread (see dispatch.h) and
+ * completions delivered back to the js thread (see CompletionChannel). Recording is switched on and off at runtime,
+ * while it is off each crossing costs a single relaxed load.
+ */
+struct LatencyStats {
+    std::atomic<bool> enabled = false;
+
+    // time commands spend in the dispatch ring before the tcpip thread runs them
+    LatencyHistogram tcpip_wait;
+    // time the tcpip thread spends running a single command
+    LatencyHistogram tcpip_busy;
+    // time from waking up the js thread to it draining the completion queue
+    LatencyHistogram completion_wait;
+
+    bool on()
+    {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+};
+
+LatencyStats latency_stats;
+
+#endif
@@ -1,61 +1,185 @@
 #ifndef LWIP_MACROS
 #define LWIP_MACROS
 
+#include "dispatch.h"
 #include "lwip/tcpip.h"
 #include "macros.h"
 #include "napi.h"
 
+#include <array>
+#include <cstring>
 #include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 /**
- * lwip's tcpip_callback (see below) but with a std::function instead of a void pointer to pass context.
- *
- *  @ingroup lwip_os
- * Call a specific function in the thread context of
- * tcpip_thread for easy access synchronization.
- * A function called in that way may access lwIP core code
- * without fearing concurrent access.
- * Blocks until the request is posted.
- * Must not be called from interrupt context!
- *
- * @param function the function to call
- * @return ERR_OK if the function was called, another err_t if not
+ * Executes `callback` in the lwip tcpip thread, which may access lwIP core code without fearing concurrent access.
  *
+ * The callable is stored in a fixed-size command record in tcpip_dispatcher's ring instead of being copied to the heap,
+ * and all commands queued before the tcpip thread gets to them are executed in a single visit (see dispatch.h). Commands
+ * are executed in order. Blocks only while the ring is full. Must not be called from the tcpip thread.
  */
-err_t typed_tcpip_callback(std::function<void()> callback)
+template <typename F> void typed_tcpip_callback(F&& callback)
 {
-    auto cb = new std::function<void()>(callback);
-
-    return tcpip_callback(
-        [](void* ctx) {
-            auto cb = reinterpret_cast<std::function<void()>*>(ctx);
-            (*cb)();
-            delete cb;
-        },
-        cb);
+    tcpip_dispatcher.push(std::forward<F>(callback));
 }
 
-std::tuple<std::string, u16_t, bool, std::string, u16_t, bool> addr_info(tcp_pcb* pcb)
+/**
+ * Like typed_tcpip_callback, but blocks until `callback` has run. Only for environment teardown, when nothing can be
+ * awaited anymore.
+ */
+template <typename F> void tcpip_callback_sync(F&& callback)
 {
-    char local[ZTS_IP_MAX_STR_LEN];
-    ipaddr_ntoa_r(&pcb->local_ip, local, ZTS_IP_MAX_STR_LEN);
+    std::promise<void> done;
+    auto future = done.get_future();
+    typed_tcpip_callback([&callback, &done]() {
+        callback();
+        done.set_value();
+    });
+    future.wait();
+}
+
+// ADDRESSES
+
+// binary address representation: 16 address bytes (only the first 4 are used for IPv4) followed by the family, 4 or 6
+#define BINARY_ADDR_LEN 17
+
+using BinaryAddr = std::array<uint8_t, BINARY_ADDR_LEN>;
+
+BinaryAddr addr_to_binary(const ip_addr_t* addr)
+{
+    BinaryAddr bin {};
+    if (IP_IS_V6(addr)) {
+        std::memcpy(bin.data(), ip_2_ip6(addr)->addr, 16);
+        bin[16] = 6;
+    }
+    else {
+        std::memcpy(bin.data(), &ip_2_ip4(addr)->addr, 4);
+        bin[16] = 4;
+    }
+    return bin;
+}
+
+/**
+ * @returns false if the family byte is neither 4 nor 6
+ */
+bool binary_to_addr(const uint8_t* bin, ip_addr_t* addr)
+{
+    if (bin[16] == 6) {
+        IP_SET_TYPE(addr, IPADDR_TYPE_V6);
+        std::memcpy(ip_2_ip6(addr)->addr, bin, 16);
+        ip6_addr_clear_zone(ip_2_ip6(addr));
+        return true;
+    }
+    if (bin[16] == 4) {
+        IP_SET_TYPE(addr, IPADDR_TYPE_V4);
+        std::memcpy(&ip_2_ip4(addr)->addr, bin, 4);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Parses an address passed from js, either as a string or in binary representation.
+ *
+ * @returns false if the address is invalid
+ */
+bool parse_addr(Napi::Value value, ip_addr_t* addr)
+{
+    if (value.IsTypedArray()) {
+        auto bin = value.As<Napi::Uint8Array>();
+        if (bin.ByteLength() < BINARY_ADDR_LEN)
+            return false;
+        return binary_to_addr(bin.Data(), addr);
+    }
+    std::string str = value.As<Napi::String>();
+    return ipaddr_aton(str.c_str(), addr);
+}
+
+/**
+ * Least recently used cache of address strings, so formatting an address and creating a js string for it only happens
+ * once for a peer that is seen repeatedly. Every js environment has its own cache, only used in its thread.
+ *
+ * The strings are kept alive in a js array, since references to primitive values aren't supported by N-API.
+ */
+class AddressCache {
+  public:
+    static constexpr uint32_t capacity = 256;
+
+    Napi::String get(Napi::Env env, const ip_addr_t* addr)
+    {
+        if (strings.IsEmpty()) {
+            strings = Napi::Persistent(Napi::Array::New(env));
+        }
+        auto key = addr_to_binary(addr);
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            return strings.Value().Get(it->second->second).As<Napi::String>();
+        }
+
+        uint32_t slot;
+        if (lru.size() < capacity) {
+            slot = lru.size();
+        }
+        else {
+            slot = lru.back().second;
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+        lru.emplace_front(key, slot);
+        index[key] = lru.begin();
+
+        char str[ZTS_IP_MAX_STR_LEN];
+        ipaddr_ntoa_r(addr, str, ZTS_IP_MAX_STR_LEN);
+        auto result = Napi::String::New(env, str);
+        strings.Value().Set(slot, result);
+        return result;
+    }
+
+  private:
+    struct Hash {
+        size_t operator()(const BinaryAddr& key) const
+        {
+            return std::hash<std::string_view>()(std::string_view((const char*)key.data(), key.size()));
+        }
+    };
 
-    char remote[ZTS_IP_MAX_STR_LEN];
-    ipaddr_ntoa_r(&pcb->remote_ip, remote, ZTS_IP_MAX_STR_LEN);
+    // most recently used first, with the slot of the string in `strings`
+    std::list<std::pair<BinaryAddr, uint32_t> > lru;
+    std::unordered_map<BinaryAddr, std::list<std::pair<BinaryAddr, uint32_t> >::iterator, Hash> index;
+    Napi::ObjectReference strings;
+};
 
-    return { std::string(local),  pcb->local_port,  IPADDR_TYPE_V6 == pcb->local_ip.type,
-             std::string(remote), pcb->remote_port, IPADDR_TYPE_V6 == pcb->remote_ip.type };
+// the cache of the environment `env` belongs to, defined in addon.h
+AddressCache& address_cache(Napi::Env env);
+
+struct AddrInfo {
+    ip_addr_t local;
+    u16_t local_port;
+    ip_addr_t remote;
+    u16_t remote_port;
+};
+
+AddrInfo addr_info(tcp_pcb* pcb)
+{
+    return { pcb->local_ip, pcb->local_port, pcb->remote_ip, pcb->remote_port };
 }
 
-Napi::Object convert_addr_info(Napi::Env env, std::tuple<std::string, u16_t, bool, std::string, u16_t, bool> addr)
+Napi::Object convert_addr_info(Napi::Env env, const AddrInfo& addr)
 {
     return OBJECT({
-        ADD_FIELD("localAddr", STRING(std::get<0>(addr)));
-        ADD_FIELD("localPort", NUMBER(std::get<1>(addr)));
-        ADD_FIELD("localFamily", std::get<2>(addr) ? STRING("IPv6") : STRING("IPv4"));
-        ADD_FIELD("remoteAddr", STRING(std::get<3>(addr)));
-        ADD_FIELD("remotePort", NUMBER(std::get<4>(addr)));
-        ADD_FIELD("remoteFamily", std::get<5>(addr) ? STRING("IPv6") : STRING("IPv4"));
+        ADD_FIELD("localAddr", address_cache(env).get(env, &addr.local));
+        ADD_FIELD("localPort", NUMBER(addr.local_port));
+        ADD_FIELD("localFamily", IP_IS_V6(&addr.local) ? STRING("IPv6") : STRING("IPv4"));
+        ADD_FIELD("remoteAddr", address_cache(env).get(env, &addr.remote));
+        ADD_FIELD("remotePort", NUMBER(addr.remote_port));
+        ADD_FIELD("remoteFamily", IP_IS_V6(&addr.remote) ? STRING("IPv6") : STRING("IPv4"));
     });
 }
 
@@ -64,7 +188,57 @@ Napi::Object convert_addr_info(Napi::Env env, std::tuple<std::string, u16_t, boo
  */
 void ts_pbuf_free(pbuf* p)
 {
-    tcpip_callback([](void* p) { pbuf_free(reinterpret_cast<pbuf*>(p)); }, p);
+    typed_tcpip_callback([p]() { pbuf_free(p); });
+}
+
+/**
+ * Threadsafe pbuf_free for a batch of pbufs, all of them are freed in a single visit to the tcpip thread.
+ */
+void ts_pbuf_free_all(std::vector<pbuf*> pbufs)
+{
+    typed_tcpip_callback([pbufs = std::move(pbufs)]() {
+        for (auto p : pbufs) {
+            pbuf_free(p);
+        }
+    });
+}
+
+/**
+ * Exposes the payload of a pbuf chain without copying it by appending a Uint8Array per pbuf to `views`. The views are
+ * backed by external ArrayBuffers which keep the chain alive and are reported to V8 as external memory, so holding on
+ * to them creates GC pressure. Once all of them have been garbage collected the chain is released through ts_pbuf_free
+ * and `released` is called, in the js thread.
+ */
+void pbuf_append_external(Napi::Env env, pbuf* p, Napi::Array views, std::function<void()> released = nullptr)
+{
+    using Holder = std::shared_ptr<pbuf>;
+    Holder holder(p, [released = std::move(released)](pbuf* p) {
+        ts_pbuf_free(p);
+        if (released)
+            released();
+    });
+
+    struct View {
+        Holder chain;
+        u16_t len;
+    };
+
+    for (pbuf* q = p; q != nullptr; q = q->next) {
+        if (q->len == 0)
+            continue;
+
+        auto buffer = Napi::ArrayBuffer::New(
+            env,
+            q->payload,
+            q->len,
+            [](Napi::Env env, void*, View* view) {
+                Napi::MemoryManagement::AdjustExternalMemory(env, -(int64_t)view->len);
+                delete view;
+            },
+            new View { holder, q->len });
+        Napi::MemoryManagement::AdjustExternalMemory(env, q->len);
+        views[views.Length()] = Napi::Uint8Array::New(env, q->len, buffer, 0);
+    }
 }
 
 #endif
\ No newline at end of file
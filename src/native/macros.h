@@ -1,9 +1,14 @@
 #ifndef NAPI_MACROS
 #define NAPI_MACROS
 
+#include "concurrentqueue.h"
+#include "histogram.h"
 #include "napi.h"
 
+#include <atomic>
 #include <functional>
+#include <memory>
+#include <mutex>
 
 // INITIALISATION
 
@@ -45,11 +50,8 @@
 
 #define CLASS_STATIC_METHOD(CLASS, NAME) StaticMethod _CLASS_METHOD(CLASS, NAME)
 
-#define CLASS_SET_CONSTRUCTOR(CLASS)                                                                                   \
-    [&]() {                                                                                                            \
-        constructor = new Napi::FunctionReference;                                                                     \
-        *constructor = Napi::Persistent(CLASS);                                                                        \
-    }()
+// constructors are kept per environment, `constructor(env)` returns the class's reference in the addon data
+#define CLASS_SET_CONSTRUCTOR(CLASS) constructor(env) = Napi::Persistent(CLASS)
 
 // METHOD
 
@@ -158,40 +160,130 @@ Napi::Promise async_run(Napi::Env env, std::function<void(DeferredPromise)> exec
     return promise->Promise();
 }
 
+// Completion channel
+
+#define COMPLETION_ARGS Napi::Env env
+
+/**
+ * Delivers the results of asynchronous operations to the js thread through a single long-lived ThreadSafeFunction
+ * instead of one per call. Completions are pushed on a lock-free queue from any thread, the js thread is woken up at
+ * most once per batch and runs everything that completed in the meantime.
+ *
+ * While completions are expected the channel keeps the event loop alive, like a pending ThreadSafeFunction would.
+ *
+ * Every js environment (the main thread and each worker) has its own channel, see addon.h.
+ */
+class CompletionChannel {
+  public:
+    using Completion = std::function<void(COMPLETION_ARGS)>;
+
+    void init(Napi::Env env)
+    {
+        tsfn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](CALLBACKINFO) {}), "completions", 0, 1);
+        tsfn.Unref(env);
+    }
+
+    /**
+     * In js thread, announces a completion that will be delivered later.
+     */
+    void expect(Napi::Env env)
+    {
+        if (pending++ == 0)
+            tsfn.Ref(env);
+    }
+
+    /**
+     * In any thread, queues a completion and wakes up the js thread if it isn't already scheduled to drain.
+     */
+    void complete(Completion completion)
+    {
+        queue.enqueue(std::move(completion));
+
+        if (! scheduled.exchange(true)) {
+            std::lock_guard lock(close_mutex);
+            if (! closed) {
+                uint64_t woken_at = latency_stats.on() ? LatencyStats::now() : 0;
+                tsfn.BlockingCall([this, woken_at](TSFN_ARGS) {
+                    if (woken_at)
+                        latency_stats.completion_wait.record(LatencyStats::now() - woken_at);
+                    this->drain(env);
+                });
+            }
+        }
+    }
+
+    /**
+     * In js thread, called when the environment is torn down. Completions arriving afterwards stay in the queue instead
+     * of waking up a thread that no longer exists.
+     */
+    void close()
+    {
+        std::lock_guard lock(close_mutex);
+        closed = true;
+    }
+
+  private:
+    Napi::ThreadSafeFunction tsfn;
+    moodycamel::ConcurrentQueue<Completion> queue;
+    std::atomic<bool> scheduled = false;
+    std::mutex close_mutex;
+    bool closed = false;
+    // only accessed in the js thread
+    size_t pending = 0;
+
+    void drain(Napi::Env env)
+    {
+        // completions queued from here on schedule a new drain
+        scheduled = false;
+
+        Completion batch[32];
+        size_t count;
+        while ((count = queue.try_dequeue_bulk(batch, 32)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                batch[i](env);
+                batch[i] = nullptr;
+            }
+            pending -= count;
+        }
+
+        if (pending == 0)
+            tsfn.Unref(env);
+    }
+};
+
+// the channel of the environment `env` belongs to, defined in addon.h
+std::shared_ptr<CompletionChannel> completion_channel(Napi::Env env);
+
 /**
  * Returns a callable which, when executed, first executes the provided function `threaded` in the current thread, and
  * then passes the result to `js_callback` in the addon's main thread.
  */
 template <typename T>
 std::function<void()>
-tsfn_once(Napi::Env env, std::string name, std::function<T()> threaded, std::function<void(TSFN_ARGS, T)> js_callback)
+async_once(Napi::Env env, std::function<T()> threaded, std::function<void(COMPLETION_ARGS, T)> js_callback)
 {
-    auto callback = Napi::Function::New(env, [](CALLBACKINFO) {});
-
-    auto tsfn = TSFN_ONCE(callback, name);
+    auto channel = completion_channel(env);
+    channel->expect(env);
 
-    return [tsfn, threaded, js_callback]() {
+    return [threaded, js_callback, channel]() {
         T ret = threaded();
 
-        tsfn->BlockingCall([js_callback, ret](TSFN_ARGS) { js_callback(env, jsCallback, ret); });
-        tsfn->Release();
+        channel->complete([js_callback, ret](COMPLETION_ARGS) { js_callback(env, ret); });
     };
 }
 
-template <typename JSF, typename TF, typename... Types>
-std::function<void()> tsfn_once_tuple(Napi::Env env, std::string name, TF threaded, JSF js_callback)
+template <typename JSF, typename TF>
+std::function<void()> async_once_tuple(Napi::Env env, TF threaded, JSF js_callback)
 {
-    auto callback = Napi::Function::New(env, [](CALLBACKINFO) {});
-
-    auto tsfn = TSFN_ONCE(callback, name);
+    auto channel = completion_channel(env);
+    channel->expect(env);
 
-    return [tsfn, threaded, js_callback]() -> void {
+    return [threaded, js_callback, channel]() -> void {
         auto ret = threaded();
 
-        tsfn->BlockingCall([js_callback, ret](TSFN_ARGS) {
-            std::apply(js_callback, std::tuple_cat(std::make_tuple(env, jsCallback), ret));
+        channel->complete([js_callback, ret](COMPLETION_ARGS) {
+            std::apply(js_callback, std::tuple_cat(std::make_tuple(env), ret));
         });
-        tsfn->Release();
     };
 }
 
@@ -199,21 +291,16 @@ std::function<void()> tsfn_once_tuple(Napi::Env env, std::string name, TF thread
  * Returns a callable which, when executed, first executes the provided function `threaded` in the current thread, and
  * then executes `js_callback` in the addon's main thread.
  */
-std::function<void()> tsfn_once_void(
-    Napi::Env env,
-    std::string name,
-    std::function<void()> threaded,
-    std::function<void(TSFN_ARGS)> js_callback)
+std::function<void()>
+async_once_void(Napi::Env env, std::function<void()> threaded, std::function<void(COMPLETION_ARGS)> js_callback)
 {
-    auto callback = Napi::Function::New(env, [](CALLBACKINFO) {});
-
-    auto tsfn = TSFN_ONCE(callback, name);
+    auto channel = completion_channel(env);
+    channel->expect(env);
 
-    return [tsfn, threaded, js_callback]() {
+    return [threaded, js_callback, channel]() {
         threaded();
 
-        tsfn->BlockingCall([js_callback](TSFN_ARGS) { js_callback(env, jsCallback); });
-        tsfn->Release();
+        channel->complete(js_callback);
     };
 }
 
@@ -0,0 +1,74 @@
+#ifndef ZT_METRICS
+#define ZT_METRICS
+
+#include "ZeroTierSockets.h"
+#include "peers.h"
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// ZeroTierOne keeps its core counters (packets in and out, errors, peer latency...) in prometheus-cpp-lite's global
+// registry, defined in node/Metrics.cpp. Older cores have neither.
+#if __has_include("Metrics.hpp") && __has_include(<prometheus/text_serializer.h>)
+#define ZT_CORE_METRICS 1
+#include "Metrics.hpp"
+#include <prometheus/text_serializer.h>
+#else
+#define ZT_CORE_METRICS 0
+#endif
+
+/**
+ * Prometheus text exposition of the ZeroTier core's counters, if the core has them, followed by the binding's peer
+ * metrics.
+ */
+std::string metrics_text()
+{
+    std::ostringstream out;
+
+#if ZT_CORE_METRICS
+    prometheus::TextSerializer().Serialize(out, prometheus::simpleapi::registry.Collect());
+#endif
+
+    auto peer_label = [](uint64_t id) { return "{peer=\"" + node_id_to_string(id) + "\"}"; };
+
+    size_t direct = 0, relay = 0, unreachable = 0;
+    std::ostringstream latency, paths, relayed, to_direct, to_relay;
+    peer_table.for_each([&](uint64_t id, const PeerTable::Peer& peer) {
+        auto label = peer_label(id);
+        direct += peer.reachability == ZTS_EVENT_PEER_DIRECT;
+        relay += peer.reachability == ZTS_EVENT_PEER_RELAY;
+        unreachable += peer.reachability == ZTS_EVENT_PEER_UNREACHABLE;
+        if (peer.latency >= 0)
+            latency << "nodezt_peer_latency_ms" << label << " " << peer.latency << "\n";
+        paths << "nodezt_peer_paths" << label << " " << peer.path_count << "\n";
+        relayed << "nodezt_peer_relayed" << label << " " << (peer.reachability == ZTS_EVENT_PEER_RELAY) << "\n";
+        to_direct << "nodezt_peer_direct_transitions_total" << label << " " << peer.to_direct << "\n";
+        to_relay << "nodezt_peer_relay_transitions_total" << label << " " << peer.to_relay << "\n";
+    });
+
+    out << "# HELP nodezt_peers Peers by how they were last reached\n"
+        << "# TYPE nodezt_peers gauge\n"
+        << "nodezt_peers{state=\"direct\"} " << direct << "\n"
+        << "nodezt_peers{state=\"relay\"} " << relay << "\n"
+        << "nodezt_peers{state=\"unreachable\"} " << unreachable << "\n";
+    out << "# HELP nodezt_peer_latency_ms Latency of the peer's best path\n"
+        << "# TYPE nodezt_peer_latency_ms gauge\n"
+        << latency.str();
+    out << "# HELP nodezt_peer_paths Number of known paths to the peer\n"
+        << "# TYPE nodezt_peer_paths gauge\n"
+        << paths.str();
+    out << "# HELP nodezt_peer_relayed Whether the peer is currently reached through a relay\n"
+        << "# TYPE nodezt_peer_relayed gauge\n"
+        << relayed.str();
+    out << "# HELP nodezt_peer_direct_transitions_total Times the peer became directly reachable\n"
+        << "# TYPE nodezt_peer_direct_transitions_total counter\n"
+        << to_direct.str();
+    out << "# HELP nodezt_peer_relay_transitions_total Times the peer fell back to a relay\n"
+        << "# TYPE nodezt_peer_relay_transitions_total counter\n"
+        << to_relay.str();
+
+    return out.str();
+}
+
+#endif
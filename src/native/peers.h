@@ -0,0 +1,99 @@
+#ifndef ZT_PEERS
+#define ZT_PEERS
+
+#include "ZeroTierSockets.h"
+#include "lwip/def.h"
+
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ZeroTier addresses are 40 bit, written as 10 hex digits
+std::string node_id_to_string(uint64_t id)
+{
+    std::ostringstream ss;
+    ss << std::hex << std::setw(10) << std::setfill('0') << id;
+    return ss.str();
+}
+
+/**
+ * Formats a physical path as "address/port", like ZeroTier itself does.
+ */
+std::string path_to_string(const zts_sockaddr_storage* addr)
+{
+    char ip[ZTS_IP_MAX_STR_LEN] = "";
+    unsigned short port = 0;
+    if (addr->ss_family == ZTS_AF_INET) {
+        auto in = reinterpret_cast<const zts_sockaddr_in*>(addr);
+        zts_inet_ntop(ZTS_AF_INET, &in->sin_addr, ip, ZTS_IP_MAX_STR_LEN);
+        port = lwip_ntohs(in->sin_port);
+    }
+    else if (addr->ss_family == ZTS_AF_INET6) {
+        auto in6 = reinterpret_cast<const zts_sockaddr_in6*>(addr);
+        zts_inet_ntop(ZTS_AF_INET6, &in6->sin6_addr, ip, ZTS_IP_MAX_STR_LEN);
+        port = lwip_ntohs(in6->sin6_port);
+    }
+    return std::string(ip) + "/" + std::to_string(port);
+}
+
+/**
+ * Last known state of every peer, maintained from libzt's peer events. The core only reports per-peer state through
+ * these events, this is what tells whether a peer is reached directly or through a relay.
+ */
+class PeerTable {
+  public:
+    struct Peer {
+        int role = 0;
+        int latency = -1;
+        unsigned path_count = 0;
+        // physical paths, as reported by the last event
+        std::vector<std::string> paths;
+        // last of ZTS_EVENT_PEER_DIRECT, _RELAY or _UNREACHABLE, 0 if none was seen yet
+        int reachability = 0;
+        uint64_t to_direct = 0;
+        uint64_t to_relay = 0;
+    };
+
+    // in libzt's event thread, returns the peer's updated state
+    Peer update(int event, const zts_peer_info_t* info)
+    {
+        std::lock_guard lock(mutex);
+        auto& peer = peers[info->peer_id];
+        peer.role = info->role;
+        peer.latency = info->latency;
+        peer.path_count = info->path_count;
+        peer.paths.clear();
+        for (unsigned i = 0; i < info->path_count && i < ZTS_MAX_PEER_NETWORK_PATHS; i++) {
+            peer.paths.push_back(path_to_string(&info->paths[i]));
+        }
+        if (event == ZTS_EVENT_PEER_DIRECT || event == ZTS_EVENT_PEER_RELAY || event == ZTS_EVENT_PEER_UNREACHABLE) {
+            if (event == ZTS_EVENT_PEER_DIRECT && peer.reachability != event)
+                peer.to_direct++;
+            if (event == ZTS_EVENT_PEER_RELAY && peer.reachability != event)
+                peer.to_relay++;
+            peer.reachability = event;
+        }
+        return peer;
+    }
+
+    // calls f(id, peer) for every peer while holding the lock
+    template <typename F> void for_each(F&& f)
+    {
+        std::lock_guard lock(mutex);
+        for (auto& [id, peer] : peers) {
+            f(id, peer);
+        }
+    }
+
+  private:
+    std::mutex mutex;
+    std::unordered_map<uint64_t, Peer> peers;
+};
+
+PeerTable peer_table;
+
+#endif
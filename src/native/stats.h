@@ -0,0 +1,161 @@
+#ifndef NODEZT_STATS
+#define NODEZT_STATS
+
+#include "lwip/memp.h"
+#include "lwip/stats.h"
+
+#include <string>
+#include <vector>
+
+/**
+ * Flat view of lwip's statistics (lwip_stats). Every counter has a fixed index, so a snapshot is just an array of
+ * numbers and the names only have to be looked up once. Which counters exist depends on the *_STATS options lwip was
+ * built with (see the LWIP_RUNTIME_STATS option in CMakeLists.txt), without LWIP_STATS there are none.
+ *
+ * `visit_stats` calls `visit(group, field, value)` for every counter, always in the same order. Names are only pieced
+ * together by lwip_stats_names, so taking a snapshot allocates nothing.
+ */
+
+#if LWIP_STATS
+
+// groups of lwip's memory pools, in the order of memp_t
+const char* const memp_groups[] = {
+#define LWIP_MEMPOOL(name, num, size, desc) "memp." #name,
+#include "lwip/priv/memp_std.h"
+};
+
+template <typename V> void visit_proto(const char* group, const struct stats_proto& proto, V& visit)
+{
+    visit(group, "xmit", proto.xmit);
+    visit(group, "recv", proto.recv);
+    visit(group, "fw", proto.fw);
+    visit(group, "drop", proto.drop);
+    visit(group, "chkerr", proto.chkerr);
+    visit(group, "lenerr", proto.lenerr);
+    visit(group, "memerr", proto.memerr);
+    visit(group, "rterr", proto.rterr);
+    visit(group, "proterr", proto.proterr);
+    visit(group, "opterr", proto.opterr);
+    visit(group, "err", proto.err);
+    visit(group, "cachehit", proto.cachehit);
+}
+
+template <typename V> void visit_igmp(const char* group, const struct stats_igmp& igmp, V& visit)
+{
+    visit(group, "xmit", igmp.xmit);
+    visit(group, "recv", igmp.recv);
+    visit(group, "drop", igmp.drop);
+    visit(group, "chkerr", igmp.chkerr);
+    visit(group, "lenerr", igmp.lenerr);
+    visit(group, "memerr", igmp.memerr);
+    visit(group, "proterr", igmp.proterr);
+    visit(group, "rx_v1", igmp.rx_v1);
+    visit(group, "rx_group", igmp.rx_group);
+    visit(group, "rx_general", igmp.rx_general);
+    visit(group, "rx_report", igmp.rx_report);
+    visit(group, "tx_join", igmp.tx_join);
+    visit(group, "tx_leave", igmp.tx_leave);
+    visit(group, "tx_report", igmp.tx_report);
+}
+
+template <typename V> void visit_mem(const char* group, const struct stats_mem& mem, V& visit)
+{
+    visit(group, "avail", mem.avail);
+    visit(group, "used", mem.used);
+    // high-water mark of used
+    visit(group, "max", mem.max);
+    // failed allocations
+    visit(group, "err", mem.err);
+    visit(group, "illegal", mem.illegal);
+}
+
+template <typename V> void visit_syselem(const char* group, const struct stats_syselem& elem, V& visit)
+{
+    visit(group, "used", elem.used);
+    visit(group, "max", elem.max);
+    visit(group, "err", elem.err);
+}
+
+#endif
+
+template <typename V> void visit_stats(V&& visit)
+{
+#if LWIP_STATS
+#if LINK_STATS
+    visit_proto("link", lwip_stats.link, visit);
+#endif
+#if ETHARP_STATS
+    visit_proto("etharp", lwip_stats.etharp, visit);
+#endif
+#if IPFRAG_STATS
+    visit_proto("ip_frag", lwip_stats.ip_frag, visit);
+#endif
+#if IP_STATS
+    visit_proto("ip", lwip_stats.ip, visit);
+#endif
+#if ICMP_STATS
+    visit_proto("icmp", lwip_stats.icmp, visit);
+#endif
+#if IGMP_STATS
+    visit_igmp("igmp", lwip_stats.igmp, visit);
+#endif
+#if UDP_STATS
+    visit_proto("udp", lwip_stats.udp, visit);
+#endif
+#if TCP_STATS
+    visit_proto("tcp", lwip_stats.tcp, visit);
+#endif
+#if MEM_STATS
+    visit_mem("mem", lwip_stats.mem, visit);
+#endif
+#if MEMP_STATS
+    for (int i = 0; i < MEMP_MAX; i++) {
+        // the pointers are set up by memp_init, before that the pool is reported as empty
+        static const struct stats_mem empty {};
+        visit_mem(memp_groups[i], lwip_stats.memp[i] ? *lwip_stats.memp[i] : empty, visit);
+    }
+#endif
+#if SYS_STATS
+    visit_syselem("sys.sem", lwip_stats.sys.sem, visit);
+    visit_syselem("sys.mutex", lwip_stats.sys.mutex, visit);
+    visit_syselem("sys.mbox", lwip_stats.sys.mbox, visit);
+#endif
+#if IP6_STATS
+    visit_proto("ip6", lwip_stats.ip6, visit);
+#endif
+#if ICMP6_STATS
+    visit_proto("icmp6", lwip_stats.icmp6, visit);
+#endif
+#if IP6_FRAG_STATS
+    visit_proto("ip6_frag", lwip_stats.ip6_frag, visit);
+#endif
+#if MLD6_STATS
+    visit_igmp("mld6", lwip_stats.mld6, visit);
+#endif
+#if ND6_STATS
+    visit_proto("nd6", lwip_stats.nd6, visit);
+#endif
+#endif
+}
+
+/**
+ * Names of the counters in the order of a snapshot, e.g. "tcp.drop" or "memp.PBUF_POOL.max".
+ */
+std::vector<std::string> lwip_stats_names()
+{
+    std::vector<std::string> names;
+    visit_stats(
+        [&](const char* group, const char* field, double) { names.push_back(std::string(group) + "." + field); });
+    return names;
+}
+
+/**
+ * In lwip tcpip thread, copies every counter to `out`, which has room for at least as many values as there are names.
+ */
+void lwip_stats_snapshot(double* out)
+{
+    size_t i = 0;
+    visit_stats([&](const char*, const char*, double value) { out[i++] = value; });
+}
+
+#endif
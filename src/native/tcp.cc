@@ -1,14 +1,28 @@
 #include "lwip/tcp.h"
 
 #include "ZeroTierSockets.h"
+#include "addon.h"
 #include "lwip-util.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
 #include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
 #include "macros.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <napi.h>
+#include <vector>
 
 namespace TCP {
 
+struct Listener;
+
 /* #########################################
  * ###############  SOCKET  ################
  * ######################################### */
@@ -16,12 +30,23 @@ namespace TCP {
 CLASS(Socket)
 {
   public:
-    static Napi::FunctionReference* constructor;
+    static Napi::FunctionReference& constructor(Napi::Env env)
+    {
+        return addon_data(env).tcp_socket;
+    }
 
     CLASS_INIT_DECL();
 
     CONSTRUCTOR(Socket) {};
 
+    ~Socket()
+    {
+        *alive = nullptr;
+    }
+
+    // cleared when the socket is freed, zero-copy chunks can outlive it
+    std::shared_ptr<Socket*> alive = std::make_shared<Socket*>(this);
+
     void set_pcb(tcp_pcb * pcb)
     {
         this->pcb = pcb;
@@ -34,13 +59,142 @@ CLASS(Socket)
     // in lwip tcpip thread
     void init(tcp_pcb * pcb);
 
+    // in lwip tcpip thread, queues received data and wakes up the js thread if it is waiting for data
+    void queue_recv(pbuf * p);
+
+    // in lwip tcpip thread, returns as much of the withheld window to the peer as the receive buffer allows
+    void update_window();
+
+    // bytes received but not yet read by js
+    std::atomic<size_t> recv_unconsumed = 0;
+    // bytes received but not yet passed to tcp_recved, only accessed in the tcpip thread
+    size_t recv_withheld = 0;
+
+    // in lwip tcpip thread, whether queueing `p` would exceed the receive budget. If so, the data is refused and lwip
+    // holds on to it until the budget allows it to be redelivered.
+    bool over_budget(pbuf * p);
+
+    // in lwip tcpip thread, releases the buffers of no-copy writes once lwip no longer references them
+    void release_pinned(bool all);
+
+    // in lwip tcpip thread, hands as much of the write queue to lwip as the send buffer allows
+    void flush_writes();
+
+    // in lwip tcpip thread, rejects all queued writes
+    void fail_writes(err_t err);
+
+    // in lwip tcpip thread, reports acknowledged bytes to js, coalescing acks that arrive before js has seen the last
+    void report_acked(u16_t len);
+
+    // stream offsets of the data handed to tcp_write and acknowledged by the peer, only accessed in the tcpip thread
+    uint64_t snd_written = 0;
+    uint64_t snd_acked = 0;
+
+    // accept queue of the server that accepted this socket, set in the js thread before the socket is attached
+    std::shared_ptr<Listener> listener;
+
+    // in lwip tcpip thread, gives up the socket's slot in its server's connection limit once it has closed
+    void release_listener();
+
+    // in lwip tcpip thread, records activity on the connection, which restarts the idle timeout
+    void touch();
+
+    // in lwip tcpip thread, starts tracking the idle timeout anew, 0 disables it
+    void set_idle_timeout(u32_t ms);
+
+    // idle timeout in ms and time of the last activity, only accessed in the tcpip thread
+    u32_t idle_timeout = 0;
+    u32_t last_active = 0;
+    // "timeout" was emitted, the timeout is only tracked again after the next activity
+    bool idle_expired = false;
+    // position in idle_wheel, only accessed in the tcpip thread
+    int wheel_slot = -1;
+    Socket* wheel_prev = nullptr;
+    Socket* wheel_next = nullptr;
+
+    // keepalive settings, applied once the socket has a pcb. Only accessed in the tcpip thread.
+    bool keepalive = false;
+    u32_t keep_idle = 0;
+    u32_t keep_intvl = 0;
+    u32_t keep_cnt = 0;
+
+    // in lwip tcpip thread
+    void apply_keepalive();
+
   private:
+    // received pbufs waiting to be read by js, protected by recv_mutex. This is the only buffer between lwip and the
+    // readable side of the js socket, so its size is what closes the window.
+    std::mutex recv_mutex;
+    std::deque<pbuf*> recv_queue;
+    bool recv_eof = false;
+    // set when js tried to read from an empty queue, the next received data then emits "readable"
+    bool recv_reading = false;
+
+    // whether received pbufs are handed to js as external buffers instead of being copied
+    bool zero_copy_recv = false;
+    // upper bound on the size of a single chunk when copying received data
+    size_t recv_chunk_size = 64 * 1024;
+
+    // amount of unconsumed data the socket buffers before the window closes, grows up to recv_buffer_max if autotuning
+    std::atomic<size_t> recv_buffer = TCP_WND;
+    size_t recv_buffer_max = 0;
+    // set in the tcpip thread whenever the window had to be closed completely, used for autotuning
+    std::atomic<bool> recv_window_closed = false;
+    std::atomic<bool> recv_update_pending = false;
+    // bytes read since the last window update was scheduled
+    size_t recv_freed = 0;
+
+    // pbufs in recv_queue
+    std::atomic<size_t> recv_packets = 0;
+    // limits on unconsumed bytes and queued pbufs beyond which received data is refused, a byte budget of 0 allows the
+    // receive buffer plus whatever window has already been advertised
+    std::atomic<size_t> recv_budget_bytes = 0;
+    std::atomic<size_t> recv_budget_packets = 1024;
+    // set when data was refused, the next read then has lwip redeliver it
+    std::atomic<bool> recv_refused = false;
+
+    // writes waiting for room in the send buffer, only accessed in the tcpip thread
+    struct Write {
+        std::shared_ptr<Napi::Reference<Napi::Uint8Array> > ref;
+        uint8_t* data;
+        size_t length;
+        size_t offset;
+        bool no_copy;
+        // only set on the last write of a send or sendv call, the writes before it complete first
+        DeferredPromise promise;
+    };
+    std::deque<Write> snd_queue;
+    // bytes in snd_queue that haven't been handed to lwip yet
+    std::atomic<size_t> snd_queued = 0;
+    // shutdown_wr was called while writes were still queued
+    bool snd_shutdown = false;
+    // acknowledged bytes that haven't been reported to js yet
+    std::atomic<size_t> snd_unreported = 0;
+
+    // buffers of no-copy writes, kept alive until the stream offset at which they end has been acknowledged
+    struct Pinned {
+        uint64_t end;
+        std::shared_ptr<Napi::Reference<Napi::Uint8Array> > ref;
+    };
+    std::deque<Pinned> snd_pinned;
+
+    // drain rate measurement for autotuning
+    std::chrono::steady_clock::time_point recv_sample_start = std::chrono::steady_clock::now();
+    size_t recv_sample_bytes = 0;
+
+    void autotune(size_t consumed);
+
+    // in js thread, frees up space in the receive buffer
+    void consumed(size_t length);
+
     tcp_pcb* pcb = nullptr;
 
     VOID_METHOD(connect);
     VOID_METHOD(setEmitter);
     METHOD(send);
-    VOID_METHOD(ack);
+    METHOD(sendv);
+    METHOD(queued);
+    METHOD(read);
     VOID_METHOD(shutdown_wr);
 
     VOID_METHOD(ref)
@@ -56,6 +210,45 @@ CLASS(Socket)
             emit->Unref(env);
     }
 
+    VOID_METHOD(zeroCopyRecv)
+    {
+        NB_ARGS(1);
+        zero_copy_recv = ARG_BOOLEAN(0);
+    }
+
+    VOID_METHOD(recvChunkSize)
+    {
+        NB_ARGS(1);
+        int64_t size = ARG_NUMBER(0).Int64Value();
+        if (size <= 0)
+            throw Napi::RangeError::New(env, "Chunk size must be positive");
+        recv_chunk_size = size;
+    }
+
+    VOID_METHOD(recvBuffer)
+    {
+        NB_ARGS(2);
+        int64_t size = ARG_NUMBER(0).Int64Value();
+        int64_t max = ARG_NUMBER(1).Int64Value();
+
+        // a size of 0 keeps the current size, autotuning is disabled unless max is larger than the size
+        if (size > 0)
+            recv_buffer = size;
+        recv_buffer_max = max > 0 && (size_t)max > recv_buffer ? max : 0;
+    }
+
+    VOID_METHOD(recvBudget)
+    {
+        NB_ARGS(2);
+        int64_t bytes = ARG_NUMBER(0).Int64Value();
+        int64_t packets = ARG_NUMBER(1).Int64Value();
+        if (bytes < 0 || packets < 1)
+            throw Napi::RangeError::New(env, "Invalid receive budget");
+
+        recv_budget_bytes = bytes;
+        recv_budget_packets = packets;
+    }
+
     VOID_METHOD(nagle)
     {
         NB_ARGS(1);
@@ -68,9 +261,12 @@ CLASS(Socket)
                 tcp_nagle_disable(pcb);
         });
     }
-};
 
-Napi::FunctionReference* Socket::constructor = nullptr;
+    VOID_METHOD(setTimeout);
+    VOID_METHOD(keepAlive);
+    METHOD(getInfo);
+    static METHOD(infoFields);
+};
 
 CLASS_INIT_IMPL(Socket)
 {
@@ -79,11 +275,21 @@ CLASS_INIT_IMPL(Socket)
         { CLASS_INSTANCE_METHOD(Socket, setEmitter),
           CLASS_INSTANCE_METHOD(Socket, connect),
           CLASS_INSTANCE_METHOD(Socket, send),
-          CLASS_INSTANCE_METHOD(Socket, ack),
+          CLASS_INSTANCE_METHOD(Socket, sendv),
+          CLASS_INSTANCE_METHOD(Socket, queued),
+          CLASS_INSTANCE_METHOD(Socket, read),
           CLASS_INSTANCE_METHOD(Socket, shutdown_wr),
           CLASS_INSTANCE_METHOD(Socket, ref),
           CLASS_INSTANCE_METHOD(Socket, unref),
-          CLASS_INSTANCE_METHOD(Socket, nagle) });
+          CLASS_INSTANCE_METHOD(Socket, zeroCopyRecv),
+          CLASS_INSTANCE_METHOD(Socket, recvChunkSize),
+          CLASS_INSTANCE_METHOD(Socket, recvBuffer),
+          CLASS_INSTANCE_METHOD(Socket, recvBudget),
+          CLASS_INSTANCE_METHOD(Socket, nagle),
+          CLASS_INSTANCE_METHOD(Socket, setTimeout),
+          CLASS_INSTANCE_METHOD(Socket, keepAlive),
+          CLASS_INSTANCE_METHOD(Socket, getInfo),
+          CLASS_STATIC_METHOD(Socket, infoFields) });
 
     CLASS_SET_CONSTRUCTOR(SocketClass);
 
@@ -91,39 +297,547 @@ CLASS_INIT_IMPL(Socket)
     return exports;
 }
 
+/**
+ * Hashed timer wheel tracking the idle timeouts of all sockets, instead of a timer per socket. Activity only updates a
+ * socket's timestamp, a socket is only looked at when the wheel reaches its slot: if it has been idle long enough it
+ * emits "timeout", otherwise it moves on to the slot of its new deadline. Deadlines beyond the wheel's span are parked in
+ * the farthest slot and rechecked. The wheel turns in the tcpip thread, and only while it holds sockets.
+ */
+class IdleWheel {
+  public:
+    static constexpr u32_t tick_ms = 100;
+    static constexpr int slots = 1024;
+
+    // in lwip tcpip thread, places the socket in the slot of its deadline
+    void insert(Socket* socket)
+    {
+        u32_t idle = sys_now() - socket->last_active;
+        u32_t remaining = idle < socket->idle_timeout ? socket->idle_timeout - idle : 0;
+        u32_t ticks = std::clamp<u32_t>((remaining + tick_ms - 1) / tick_ms, 1, slots - 1);
+
+        int slot = (current + ticks) % slots;
+        socket->wheel_slot = slot;
+        socket->wheel_prev = nullptr;
+        socket->wheel_next = heads[slot];
+        if (heads[slot])
+            heads[slot]->wheel_prev = socket;
+        heads[slot] = socket;
+        count++;
+
+        if (! turning) {
+            turning = true;
+            sys_timeout(tick_ms, turn, this);
+        }
+    }
+
+    // in lwip tcpip thread
+    void remove(Socket* socket)
+    {
+        if (socket->wheel_slot < 0)
+            return;
+        if (socket->wheel_prev)
+            socket->wheel_prev->wheel_next = socket->wheel_next;
+        else
+            heads[socket->wheel_slot] = socket->wheel_next;
+        if (socket->wheel_next)
+            socket->wheel_next->wheel_prev = socket->wheel_prev;
+        socket->wheel_slot = -1;
+        count--;
+    }
+
+  private:
+    Socket* heads[slots] = {};
+    int current = 0;
+    // whether a tick is scheduled
+    bool turning = false;
+    // sockets in the wheel, it stops turning when there are none
+    size_t count = 0;
+
+    static void turn(void* arg)
+    {
+        auto wheel = reinterpret_cast<IdleWheel*>(arg);
+        wheel->turning = false;
+        wheel->current = (wheel->current + 1) % slots;
+
+        auto socket = wheel->heads[wheel->current];
+        wheel->heads[wheel->current] = nullptr;
+        u32_t now = sys_now();
+        while (socket) {
+            auto next = socket->wheel_next;
+            socket->wheel_slot = -1;
+            wheel->count--;
+            if (now - socket->last_active >= socket->idle_timeout) {
+                socket->idle_expired = true;
+                if (socket->emit)
+                    socket->emit->BlockingCall([](TSFN_ARGS) { jsCallback.Call({ STRING("timeout") }); });
+            }
+            else {
+                wheel->insert(socket);
+            }
+            socket = next;
+        }
+
+        if (! wheel->turning && wheel->count > 0) {
+            wheel->turning = true;
+            sys_timeout(tick_ms, turn, arg);
+        }
+    }
+};
+
+IdleWheel idle_wheel;
+
+void Socket::touch()
+{
+    // a closed socket or one without a timeout must never go back into the wheel
+    if (! pcb || ! idle_timeout)
+        return;
+    last_active = sys_now();
+    if (idle_expired) {
+        idle_expired = false;
+        idle_wheel.insert(this);
+    }
+}
+
+void Socket::set_idle_timeout(u32_t ms)
+{
+    idle_wheel.remove(this);
+    idle_timeout = ms;
+    idle_expired = false;
+    last_active = sys_now();
+    if (ms && pcb)
+        idle_wheel.insert(this);
+}
+
+void Socket::apply_keepalive()
+{
+    if (! keepalive) {
+        ip_reset_option(pcb, SOF_KEEPALIVE);
+        return;
+    }
+    ip_set_option(pcb, SOF_KEEPALIVE);
+    if (keep_idle)
+        pcb->keep_idle = keep_idle;
+#if LWIP_TCP_KEEPALIVE
+    if (keep_intvl)
+        pcb->keep_intvl = keep_intvl;
+    if (keep_cnt)
+        pcb->keep_cnt = keep_cnt;
+#endif
+}
+
+/**
+ * Emits "timeout" once the connection has been idle for `timeout` ms. Activity after that starts the timeout again.
+ *
+ * @param timeout { number } 0 disables the timeout
+ */
+VOID_METHOD(Socket::setTimeout)
+{
+    NB_ARGS(1);
+    int64_t timeout = ARG_NUMBER(0).Int64Value();
+    if (timeout < 0)
+        throw Napi::RangeError::New(env, "Timeout must not be negative");
+
+    u32_t ms = std::min<int64_t>(timeout, UINT32_MAX);
+
+    typed_tcpip_callback([this, ms]() { this->set_idle_timeout(ms); });
+}
+
+/**
+ * Configures lwip's keepalive probes. A value of 0 for any of the times or the count keeps lwip's default.
+ *
+ * @param enable { boolean }
+ * @param idle { number } ms without activity before the first probe
+ * @param interval { number } ms between probes
+ * @param count { number } unanswered probes after which the connection is dropped
+ */
+VOID_METHOD(Socket::keepAlive)
+{
+    NB_ARGS(4);
+    bool enable = ARG_BOOLEAN(0);
+    u32_t idle = ARG_NUMBER(1).Uint32Value();
+    u32_t interval = ARG_NUMBER(2).Uint32Value();
+    u32_t count = ARG_NUMBER(3).Uint32Value();
+
+    typed_tcpip_callback([this, enable, idle, interval, count]() {
+        this->keepalive = enable;
+        this->keep_idle = idle;
+        this->keep_intvl = interval;
+        this->keep_cnt = count;
+        if (this->pcb)
+            this->apply_keepalive();
+    });
+}
+
+/**
+ * Fields of a connection's TCP_INFO-like snapshot, see fill_tcp_info. Times are in ms, window and buffer sizes in bytes.
+ */
+const char* const tcp_info_fields[] = {
+    "state",       // enum tcp_state, 0 (CLOSED) once the socket has no pcb
+    "cwnd",        //
+    "ssthresh",    //
+    "sndWnd",      // peer's receive window
+    "rcvWnd",      // window announced to the peer
+    "sndBuf",      // free space in the send buffer
+    "sndQueueLen", // pbufs queued for sending
+    "mss",         //
+    "retransmits", // retransmissions of the current segment
+    "unacked",     // segments sent but not yet acknowledged
+    "unsent",      // segments queued but not yet sent
+    "srtt",        // smoothed round trip time
+    "rttvar",      // round trip time variation
+    "rto",         // retransmission timeout
+    "rttPending",  // a round trip time measurement is in progress
+    "remotePort",  //
+};
+
+constexpr size_t tcp_info_length = sizeof(tcp_info_fields) / sizeof(tcp_info_fields[0]);
+
+size_t count_segments(const tcp_seg* seg)
+{
+    size_t count = 0;
+    for (; seg; seg = seg->next) {
+        count++;
+    }
+    return count;
+}
+
+// in lwip tcpip thread, writes tcp_info_length values describing `pcb` to `row`
+void fill_tcp_info(const tcp_pcb* pcb, double* row)
+{
+    if (! pcb) {
+        std::fill(row, row + tcp_info_length, 0);
+        return;
+    }
+    // sa is the smoothed rtt scaled by 8, sv the variation scaled by 4, both in slow timer ticks (see tcp_receive)
+    double tick = TCP_SLOW_INTERVAL;
+    double values[] = {
+        (double)pcb->state,
+        (double)pcb->cwnd,
+        (double)pcb->ssthresh,
+        (double)pcb->snd_wnd,
+        (double)pcb->rcv_ann_wnd,
+        (double)pcb->snd_buf,
+        (double)pcb->snd_queuelen,
+        (double)pcb->mss,
+        (double)pcb->nrtx,
+        (double)count_segments(pcb->unacked),
+        (double)count_segments(pcb->unsent),
+        (pcb->sa >> 3) * tick,
+        (pcb->sv >> 2) * tick,
+        pcb->rto * tick,
+        (double)(pcb->rttest != 0),
+        (double)pcb->remote_port,
+    };
+    static_assert(sizeof(values) / sizeof(values[0]) == tcp_info_length);
+    std::copy(values, values + tcp_info_length, row);
+}
+
+/**
+ * @returns { string[] } names of the values written by getInfo and Server.connectionsInfo, in order
+ */
+METHOD(Socket::infoFields)
+{
+    NO_ARGS();
+    auto result = Napi::Array::New(env, tcp_info_length);
+    for (uint32_t i = 0; i < tcp_info_length; i++) {
+        result[i] = STRING(tcp_info_fields[i]);
+    }
+    return result;
+}
+
+/**
+ * Snapshots the connection's congestion control and queue state in the tcpip thread, directly into `out`, which can be
+ * reused across calls.
+ *
+ * @param out { Float64Array } with room for a value per name returned by infoFields
+ * @returns { Promise<void> } resolves once `out` holds the snapshot
+ */
+METHOD(Socket::getInfo)
+{
+    NB_ARGS(1);
+    auto out = info[0].As<Napi::Float64Array>();
+    if (out.ElementLength() < tcp_info_length)
+        throw Napi::RangeError::New(env, "Info array too small");
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once_void(
+            env, [this, row = out.Data()]() { fill_tcp_info(this->pcb, row); },
+            [outRef = ref_value(out), promise](COMPLETION_ARGS) {
+                outRef->Reset();
+                promise->Resolve(UNDEFINED);
+            }));
+    });
+}
+
 void Socket::emit_close()
 {
+    // nothing is sent anymore, and references can only be reset through the emitter
+    release_pinned(true);
+    fail_writes(ERR_CLSD);
     emit->BlockingCall([](TSFN_ARGS) { jsCallback.Call({ STRING("close") }); });
     emit->Release();
     emit = nullptr;
 }
 
+void Socket::queue_recv(pbuf* p)
+{
+    bool readable;
+    {
+        std::lock_guard lock(recv_mutex);
+        if (p) {
+            recv_queue.push_back(p);
+            recv_packets++;
+        }
+        else
+            recv_eof = true;
+
+        readable = recv_reading;
+        recv_reading = false;
+    }
+
+    if (readable) {
+        emit->BlockingCall([](TSFN_ARGS) { jsCallback.Call({ STRING("readable") }); });
+    }
+    if (! p) {
+        emit->BlockingCall([](TSFN_ARGS) { jsCallback.Call({ STRING("end") }); });
+    }
+}
+
+void Socket::update_window()
+{
+    if (! pcb)
+        return;
+
+    size_t unconsumed = recv_unconsumed;
+    size_t buffer = recv_buffer;
+
+    // advertise whatever room is left in the receive buffer, lwip can't open the window any further than TCP_WND
+    size_t open = buffer > unconsumed ? LWIP_MIN(buffer - unconsumed, (size_t)TCP_WND) : 0;
+    size_t target = TCP_WND - open;
+
+    if (open == 0)
+        recv_window_closed = true;
+
+    while (recv_withheld > target) {
+        u16_t len = (u16_t)LWIP_MIN(recv_withheld - target, 0xffff);
+        tcp_recved(pcb, len);
+        recv_withheld -= len;
+    }
+}
+
+/**
+ * Grows the receive buffer when the consumer drains faster than the buffer allows, i.e. when the window had to be
+ * closed while more than half of the buffer was consumed per sample period.
+ */
+void Socket::autotune(size_t consumed)
+{
+    using namespace std::chrono;
+
+    if (! recv_buffer_max)
+        return;
+
+    recv_sample_bytes += consumed;
+    auto now = steady_clock::now();
+    if (now - recv_sample_start < milliseconds(100))
+        return;
+
+    size_t buffer = recv_buffer;
+    if (recv_window_closed.exchange(false) && recv_sample_bytes * 2 > buffer) {
+        recv_buffer = LWIP_MIN(recv_buffer_max, LWIP_MAX(buffer * 2, recv_sample_bytes * 2));
+    }
+
+    recv_sample_start = now;
+    recv_sample_bytes = 0;
+}
+
+bool Socket::over_budget(pbuf* p)
+{
+    size_t bytes = recv_budget_bytes;
+    if (! bytes)
+        bytes = recv_buffer + TCP_WND;
+
+    // a single pbuf is always accepted into an empty queue, otherwise a budget smaller than a segment would stall
+    if (recv_packets == 0)
+        return false;
+
+    if (recv_packets >= recv_budget_packets || recv_unconsumed + p->tot_len > bytes) {
+        recv_refused = true;
+        return true;
+    }
+    return false;
+}
+
 err_t tcp_receive_cb(void* arg, struct tcp_pcb* tpcb, struct pbuf* p, err_t err)
 {
     auto thiz = reinterpret_cast<Socket*>(arg);
-    thiz->emit->BlockingCall([p](TSFN_ARGS) {
-        if (! p) {
-            jsCallback.Call({ STRING("data"), UNDEFINED });
-        }
-        else {
-            auto data = Napi::Uint8Array::New(env, p->tot_len);
-            pbuf_copy_partial(p, data.Data(), p->tot_len, 0);
-            ts_pbuf_free(p);
-            jsCallback.Call({ STRING("data"), data });
-        }
-    });
+    if (p && thiz->over_budget(p)) {
+        // lwip keeps the pbuf as refused data and offers it again later
+        return ERR_MEM;
+    }
+    if (p) {
+        thiz->recv_unconsumed += p->tot_len;
+        thiz->recv_withheld += p->tot_len;
+        thiz->update_window();
+        thiz->touch();
+    }
+    thiz->queue_recv(p);
 
     if (tpcb->state == TIME_WAIT) {
         // tx shutdown and FIN received
+        thiz->release_listener();
+        thiz->set_idle_timeout(0);
         thiz->emit_close();
     }
     return ERR_OK;
 }
 
+/**
+ * References are only reset in the js thread, the last shared_ptr to them can be dropped in any thread afterwards.
+ */
+void Socket::release_pinned(bool all)
+{
+    if (! emit)
+        return;
+
+    std::vector<std::shared_ptr<Napi::Reference<Napi::Uint8Array> > > released;
+    while (! snd_pinned.empty() && (all || snd_pinned.front().end <= snd_acked)) {
+        released.push_back(std::move(snd_pinned.front().ref));
+        snd_pinned.pop_front();
+    }
+    if (released.empty())
+        return;
+
+    emit->BlockingCall([released, acked = snd_acked](TSFN_ARGS) {
+        for (auto& ref : released) {
+            ref->Reset();
+        }
+        jsCallback.Call({ STRING("released"), NUMBER(acked) });
+    });
+}
+
+void Socket::flush_writes()
+{
+    // without an emitter the writes can't be completed, they are left to be freed together with the socket
+    if (! pcb || ! emit)
+        return;
+
+    std::vector<Write> completed;
+    bool written = false;
+    err_t failed = ERR_OK;
+
+    while (! snd_queue.empty()) {
+        auto& write = snd_queue.front();
+
+        tcpwnd_size_t len = LWIP_MIN(UINT16_MAX, LWIP_MIN(tcp_sndbuf(pcb), write.length - write.offset));
+        if (len == 0)
+            break;
+
+        u8_t flags = write.no_copy ? 0 : TCP_WRITE_FLAG_COPY;
+        if (write.offset + len < write.length || snd_queue.size() > 1)
+            flags |= TCP_WRITE_FLAG_MORE;
+
+        err_t err = tcp_write(pcb, write.data + write.offset, len, flags);
+        // out of memory or segments, retried from tcp_sent_cb or tcp_poll_cb
+        if (err == ERR_MEM)
+            break;
+        if (err != ERR_OK) {
+            // lwip still sends the part of a no-copy write it already took, so that part stays pinned until acked
+            if (write.no_copy && write.offset > 0)
+                snd_pinned.push_back({ snd_written, std::move(write.ref) });
+            failed = err;
+            break;
+        }
+
+        written = true;
+        write.offset += len;
+        snd_written += len;
+        snd_queued -= len;
+
+        if (write.offset == write.length) {
+            if (write.no_copy) {
+                snd_pinned.push_back({ snd_written, write.ref });
+            }
+            completed.push_back(std::move(write));
+            snd_queue.pop_front();
+        }
+    }
+
+    if (snd_shutdown && snd_queue.empty()) {
+        snd_shutdown = false;
+        tcp_shutdown(pcb, 0, 1);
+    }
+    else if (written) {
+        tcp_output(pcb);
+    }
+
+    if (! completed.empty()) {
+        emit->BlockingCall([completed](TSFN_ARGS) {
+            for (auto& write : completed) {
+                // pinned buffers are reset once released
+                if (! write.no_copy)
+                    write.ref->Reset();
+                if (write.promise)
+                    write.promise->Resolve(UNDEFINED);
+            }
+        });
+    }
+
+    if (failed != ERR_OK)
+        fail_writes(failed);
+}
+
+void Socket::fail_writes(err_t err)
+{
+    if (snd_queue.empty() || ! emit)
+        return;
+
+    std::vector<Write> failed(std::make_move_iterator(snd_queue.begin()), std::make_move_iterator(snd_queue.end()));
+    snd_queue.clear();
+    snd_queued = 0;
+
+    emit->BlockingCall([failed, err](TSFN_ARGS) {
+        for (auto& write : failed) {
+            // null if the buffer was pinned instead
+            if (write.ref)
+                write.ref->Reset();
+            if (write.promise)
+                write.promise->Reject(ERROR("Write failed", err).Value());
+        }
+    });
+}
+
+void Socket::report_acked(u16_t len)
+{
+    if (snd_unreported.fetch_add(len) > 0 || ! emit)
+        return;
+
+    emit->BlockingCall([this](TSFN_ARGS) {
+        size_t acked = this->snd_unreported.exchange(0);
+        jsCallback.Call({ STRING("sent"), NUMBER(acked) });
+    });
+}
+
 err_t tcp_sent_cb(void* arg, struct tcp_pcb* tpcb, u16_t len)
 {
     auto thiz = reinterpret_cast<Socket*>(arg);
-    thiz->emit->BlockingCall([len](TSFN_ARGS) { jsCallback.Call({ STRING("sent"), NUMBER(len) }); });
+    thiz->snd_acked += len;
+    thiz->touch();
+    thiz->release_pinned(false);
+    thiz->flush_writes();
+    thiz->report_acked(len);
+
+    return ERR_OK;
+}
+
+/**
+ * tcp_sent_cb only retries refused writes while data is in flight, when lwip ran out of memory with nothing unacked
+ * the write queue would stall without this.
+ */
+err_t tcp_poll_cb(void* arg, struct tcp_pcb* tpcb)
+{
+    auto thiz = reinterpret_cast<Socket*>(arg);
+    thiz->flush_writes();
+
     return ERR_OK;
 }
 
@@ -131,6 +845,11 @@ void tcp_err_cb(void* arg, err_t err)
 {
     auto thiz = reinterpret_cast<Socket*>(arg);
     thiz->set_pcb(nullptr);   // TODO: cleanup tsfn properly
+    thiz->release_listener();
+    thiz->set_idle_timeout(0);
+    // lwip has freed all queued segments
+    thiz->release_pinned(true);
+    thiz->fail_writes(err);
 
     if (err == ERR_CLSD) {
         thiz->emit_close();
@@ -159,7 +878,15 @@ void Socket::init(tcp_pcb* pcb)
 
     tcp_sent(this->pcb, tcp_sent_cb);
 
+    // every second, in TCP_SLOW_INTERVAL ticks like netconn's poll
+    tcp_poll(this->pcb, tcp_poll_cb, 2);
+
     tcp_err(this->pcb, tcp_err_cb);
+
+    if (keepalive)
+        apply_keepalive();
+    if (idle_timeout)
+        set_idle_timeout(idle_timeout);
 }
 
 VOID_METHOD(Socket::connect)
@@ -190,66 +917,493 @@ VOID_METHOD(Socket::connect)
     });
 }
 
+/**
+ * Queues `data` for sending. The queue is drained into lwip's send buffer immediately and from tcp_sent_cb as
+ * acknowledgements make room.
+ *
+ * @param data { Uint8Array }
+ * @param noCopy { boolean } if true, lwip references `data` instead of copying it. The buffer is kept alive until the
+ * peer has acknowledged it, which is signalled by a "released" event with the acknowledged stream offset.
+ * @returns { Promise<void> } resolves once all of `data` has been handed to lwip
+ */
 METHOD(Socket::send)
 {
     NB_ARGS(1);
     auto data = ARG_UINT8ARRAY(0);
+    bool no_copy = info.Length() > 1 && ARG_BOOLEAN(1);
+
+    snd_queued += data.ByteLength();
 
     return async_run(env, [&](auto promise) {
-        typed_tcpip_callback(tsfn_once<tcpwnd_size_t>(
-            env,
-            "Socket::send",
-            [this, bufLength = data.ByteLength(), buffer = data.Data()]() {
-                tcpwnd_size_t sent = 0;
-
-                while (true) {
-                    tcpwnd_size_t sndbuf = tcp_sndbuf(this->pcb);
-                    auto len = LWIP_MIN(UINT16_MAX, LWIP_MIN(sndbuf, bufLength - sent));
-                    if (len == 0)
-                        break;
-
-                    tcp_write(this->pcb, buffer + sent, len, TCP_WRITE_FLAG_COPY);
-                    sent += len;
-                }
+        typed_tcpip_callback(
+            [this, write = Write { ref_uint8array(data), data.Data(), data.ByteLength(), 0, no_copy, promise }]() {
+                this->snd_queue.push_back(write);
+                this->touch();
+                this->flush_writes();
+            });
+    });
+}
 
-                return sent;
-            },
-            [dataRef = ref_uint8array(data), promise](TSFN_ARGS, auto len) -> void {
-                dataRef->Reset();
-                promise->Resolve(NUMBER(len));
-            }));
+/**
+ * Queues all `chunks` in a single visit to the tcpip thread. They are written with TCP_WRITE_FLAG_MORE so lwip fills
+ * whole segments across chunk boundaries, and are sent out with a single tcp_output.
+ *
+ * @param chunks { Uint8Array[] }
+ * @param noCopy { boolean } see send
+ * @returns { Promise<void> } resolves once all chunks have been handed to lwip
+ */
+METHOD(Socket::sendv)
+{
+    NB_ARGS(1);
+    auto array = info[0].As<Napi::Array>();
+    bool no_copy = info.Length() > 1 && ARG_BOOLEAN(1);
+
+    return async_run(env, [&](auto promise) {
+        std::vector<Write> writes;
+        for (uint32_t i = 0; i < array.Length(); i++) {
+            auto data = array.Get(i).As<Napi::Uint8Array>();
+            writes.push_back({ ref_uint8array(data), data.Data(), data.ByteLength(), 0, no_copy, nullptr });
+            snd_queued += data.ByteLength();
+        }
+        if (writes.empty()) {
+            return promise->Resolve(UNDEFINED);
+        }
+        writes.back().promise = promise;
+
+        typed_tcpip_callback([this, writes = std::move(writes)]() {
+            this->snd_queue.insert(this->snd_queue.end(), writes.begin(), writes.end());
+            this->touch();
+            this->flush_writes();
+        });
     });
 }
 
-VOID_METHOD(Socket::ack)
+/**
+ * @returns { number } the amount of bytes queued by send that haven't been handed to lwip yet
+ */
+METHOD(Socket::queued)
+{
+    NO_ARGS();
+    return NUMBER(snd_queued);
+}
+
+/**
+ * Marks `length` received bytes as consumed. The window is reopened from the tcpip thread, but only once enough has been
+ * freed to be worth a window update, the buffer has been drained completely or data was refused for exceeding the
+ * receive budget.
+ */
+void Socket::consumed(size_t length)
+{
+    size_t unconsumed = recv_unconsumed.fetch_sub(length) - length;
+    recv_freed += length;
+    autotune(length);
+
+    if (unconsumed > 0 && recv_freed < TCP_WND_UPDATE_THRESHOLD && ! recv_refused)
+        return;
+
+    if (! recv_update_pending.exchange(true)) {
+        recv_freed = 0;
+        typed_tcpip_callback([this]() {
+            this->recv_update_pending = false;
+            this->update_window();
+
+            // have lwip redeliver data that was refused while the socket was over its budget
+            bool refused = this->recv_refused.exchange(false);
+            if (refused && this->pcb && this->pcb->refused_data) {
+                tcp_process_refused_data(this->pcb);
+            }
+        });
+    }
+}
+
+/**
+ * Pulls whole pbufs from the receive queue until at least `size` bytes have been read.
+ *
+ * @returns { Uint8Array[] | null | undefined } the received chunks, null once the peer has closed its side and
+ * everything has been read, or undefined if nothing has been received yet, in which case "readable" is emitted as soon
+ * as there is.
+ */
+METHOD(Socket::read)
 {
     NB_ARGS(1);
-    int length = ARG_NUMBER(0);
+    size_t size = ARG_NUMBER(0).Int64Value();
+
+    std::vector<pbuf*> queue;
+    size_t total = 0;
+    {
+        std::lock_guard lock(recv_mutex);
+        if (recv_queue.empty()) {
+            if (recv_eof)
+                return env.Null();
+
+            recv_reading = true;
+            return UNDEFINED;
+        }
 
-    typed_tcpip_callback([pcb = this->pcb, length]() {
-        size_t remaining = length;
         do {
-            u16_t recved = (u16_t)((remaining > 0xffff) ? 0xffff : remaining);
-            tcp_recved(pcb, recved);
-            remaining -= recved;
-        } while (remaining != 0);
-        // tcp_recved(pcb, length);
-    });
+            auto p = recv_queue.front();
+            recv_queue.pop_front();
+            recv_packets--;
+            queue.push_back(p);
+            total += p->tot_len;
+        } while (total < size && ! recv_queue.empty());
+    }
+
+    auto chunks = Napi::Array::New(env);
+
+    if (zero_copy_recv) {
+        // lwip's buffers only count as consumed once js let go of them, so a reader holding on to its chunks closes the
+        // window and runs into the receive budget instead of draining lwip's pools
+        for (auto p : queue) {
+            pbuf_append_external(env, p, chunks, [alive = this->alive, len = p->tot_len]() {
+                if (*alive)
+                    (*alive)->consumed(len);
+            });
+        }
+    }
+    else {
+        // merge the pbufs into as few chunks as the chunk size allows
+        auto it = queue.begin();
+        u16_t offset = 0;
+        size_t remaining = total;
+        for (uint32_t i = 0; remaining > 0; i++) {
+            auto data = Napi::Uint8Array::New(env, LWIP_MIN(remaining, recv_chunk_size));
+            size_t filled = 0;
+            while (filled < data.ByteLength()) {
+                auto len = (u16_t)LWIP_MIN(data.ByteLength() - filled, (size_t)((*it)->tot_len - offset));
+                auto copied = pbuf_copy_partial(*it, data.Data() + filled, len, offset);
+                filled += copied;
+                offset += copied;
+                if (offset == (*it)->tot_len) {
+                    it++;
+                    offset = 0;
+                }
+            }
+            remaining -= filled;
+            chunks[i] = data;
+        }
+        ts_pbuf_free_all(std::move(queue));
+        consumed(total);
+    }
+
+    return chunks;
 }
 
+/**
+ * Shuts down the sending side once all queued writes have been handed to lwip.
+ */
 VOID_METHOD(Socket::shutdown_wr)
 {
-    typed_tcpip_callback([pcb = this->pcb]() { tcp_shutdown(pcb, 0, 1); });
+    typed_tcpip_callback([this]() {
+        if (this->snd_queue.empty()) {
+            tcp_shutdown(this->pcb, 0, 1);
+        }
+        else {
+            this->snd_shutdown = true;
+        }
+    });
 }
 
 /* #########################################
  * ###############  SERVER  ################
  * ######################################### */
 
+/**
+ * Accept queue of a listening pcb. Connections that completed the handshake wait here until js picks them up, the whole
+ * queue is handed over in a single call into js. Connections beyond the backlog or the connection limit are aborted in
+ * the tcpip thread before any js object exists for them. Shared between the Server and the sockets it accepted, which
+ * give up their slot in the connection limit when they close.
+ */
+struct ListenGroup;
+
+struct Listener : std::enable_shared_from_this<Listener> {
+    struct Pending {
+        Listener* listener;
+        tcp_pcb* pcb;
+        AddrInfo addr;
+        // only accessed in the tcpip thread, set if the connection died before it was attached to its socket
+        err_t err = ERR_OK;
+        // only accessed in the tcpip thread, set if a FIN arrived before the connection was attached to its socket
+        bool fin = false;
+        // handed to js, protected by mutex
+        bool taken = false;
+    };
+
+    Napi::ThreadSafeFunction* onConnection;
+
+    // maximum number of connections waiting to be picked up by js
+    size_t backlog;
+    // maximum number of open connections, SIZE_MAX if unlimited
+    std::atomic<size_t> max_connections = SIZE_MAX;
+    // connections accepted and not closed yet, only accessed in the tcpip thread
+    size_t connections = 0;
+
+    std::mutex mutex;
+    std::vector<Pending*> pending;
+    size_t dropped = 0;
+    bool wakeup_scheduled = false;
+
+    // listening pcb the connections come from, only accessed in the tcpip thread
+    ListenGroup* group = nullptr;
+
+    // registered by createServer after onConnection, so it runs before the tsfn is torn down with the environment.
+    // accept_cb must not pick this listener anymore by then.
+    Napi::Env::CleanupHook<void (*)(Listener*), Listener> teardown_hook;
+
+    Listener(Napi::ThreadSafeFunction* onConnection, size_t backlog) : onConnection(onConnection), backlog(backlog)
+    {
+    }
+
+    // in lwip tcpip thread, whether another connection is within the backlog and the connection limit
+    bool has_room()
+    {
+        std::lock_guard lock(mutex);
+        return connections < max_connections && pending.size() < backlog;
+    }
+
+    // in lwip tcpip thread, called with mutex held. Wakes up js unless a wakeup is already on its way.
+    void wakeup();
+
+    // in lwip tcpip thread, aborts the connections js hasn't picked up yet
+    void abort_pending();
+
+    // in lwip tcpip thread, stops taking connections from the group's pcb, which is closed with the last listener. The
+    // caller has to hold a reference, the group's may be the last one.
+    void leave_group();
+
+    // in js thread, when the environment is torn down without the server being closed
+    static void teardown(Listener * listener);
+};
+
+/**
+ * Listening pcb and the accept queues it hands connections to. Usually that is the queue of a single server, but servers
+ * in several environments (e.g. worker threads) can share a pcb by listening on the same address and port with
+ * `reusePort`, connections are then distributed among them in turn. Only accessed in the tcpip thread.
+ */
+struct ListenGroup {
+    tcp_pcb* pcb = nullptr;
+    std::vector<std::shared_ptr<Listener> > listeners;
+    size_t next = 0;
+
+    // key in listen_groups if the pcb can be shared
+    bool shared = false;
+    std::pair<BinaryAddr, u16_t> key;
+
+    // the next listener in turn that has room for another connection, or just the next one if none has
+    Listener* pick()
+    {
+        size_t n = listeners.size();
+        for (size_t i = 0; i < n; i++) {
+            auto listener = listeners[(next + i) % n].get();
+            if (listener->has_room()) {
+                next = (next + i + 1) % n;
+                return listener;
+            }
+        }
+        auto listener = listeners[next % n].get();
+        next = (next + 1) % n;
+        return listener;
+    }
+};
+
+// listening pcbs that can be shared, by local address and port. Only accessed in the tcpip thread.
+std::map<std::pair<BinaryAddr, u16_t>, ListenGroup*> listen_groups;
+
+void Listener::leave_group()
+{
+    if (! group)
+        return;
+
+    auto& listeners = group->listeners;
+    listeners.erase(std::find_if(listeners.begin(), listeners.end(), [this](auto& l) { return l.get() == this; }));
+
+    // the pcb stays open while other servers share it
+    if (listeners.empty()) {
+        tcp_close(group->pcb);
+        if (group->shared)
+            listen_groups.erase(group->key);
+        delete group;
+    }
+    group = nullptr;
+
+    abort_pending();
+    onConnection->Release();
+}
+
+void Listener::teardown(Listener* listener)
+{
+    // the hook is freed once it has run
+    listener->teardown_hook = {};
+    tcpip_callback_sync([listener = listener->shared_from_this()]() { listener->leave_group(); });
+}
+
+void Socket::release_listener()
+{
+    if (listener) {
+        listener->connections--;
+        listener.reset();
+    }
+}
+
+// in lwip tcpip thread, attaches accepted connections to the sockets js created for them
+void attach_connections(const std::vector<Listener::Pending*>& batch, const std::vector<Socket*>& sockets)
+{
+    for (size_t i = 0; i < batch.size(); i++) {
+        auto entry = batch[i];
+        auto socket = sockets[i];
+        auto pcb = entry->pcb;
+        auto err = entry->err;
+        auto fin = entry->fin;
+        delete entry;
+
+        if (err != ERR_OK) {
+            tcp_err_cb(socket, err);
+            continue;
+        }
+
+        socket->init(pcb);
+        tcp_backlog_accepted(pcb);
+
+        // hand over what arrived in the meantime
+        if (pcb->refused_data && tcp_process_refused_data(pcb) == ERR_ABRT)
+            continue;
+        if (fin)
+            tcp_receive_cb(socket, pcb, nullptr, ERR_OK);
+    }
+}
+
+void Listener::wakeup()
+{
+    if (wakeup_scheduled)
+        return;
+    wakeup_scheduled = true;
+
+    int tsfnErr = onConnection->NonBlockingCall([listener = shared_from_this()](TSFN_ARGS) {
+        std::vector<Pending*> batch;
+        size_t dropped;
+        {
+            std::lock_guard lock(listener->mutex);
+            batch.swap(listener->pending);
+            for (auto entry : batch)
+                entry->taken = true;
+            dropped = listener->dropped;
+            listener->dropped = 0;
+            listener->wakeup_scheduled = false;
+        }
+        if (batch.empty() && dropped == 0)
+            return;
+
+        auto socketObjs = Napi::Array::New(env, batch.size());
+        auto addrs = Napi::Array::New(env, batch.size());
+        std::vector<Socket*> sockets(batch.size());
+        for (uint32_t i = 0; i < batch.size(); i++) {
+            auto socketObj = Socket::constructor(env).New({});
+            auto socket = Socket::Unwrap(socketObj);
+            socket->set_pcb(batch[i]->pcb);
+            socket->listener = listener;
+            sockets[i] = socket;
+            socketObjs[i] = socketObj;
+            addrs[i] = convert_addr_info(env, batch[i]->addr);
+        }
+
+        jsCallback.Call({ UNDEFINED, socketObjs, addrs, NUMBER(dropped) });
+
+        // event handlers set in callback so now accept connections
+        if (! batch.empty()) {
+            typed_tcpip_callback([batch = std::move(batch), sockets = std::move(sockets)]() {
+                attach_connections(batch, sockets);
+            });
+        }
+    });
+    if (tsfnErr != napi_ok) {
+        wakeup_scheduled = false;
+    }
+}
+
+void Listener::abort_pending()
+{
+    std::vector<Pending*> batch;
+    {
+        std::lock_guard lock(mutex);
+        batch.swap(pending);
+    }
+    for (auto entry : batch) {
+        tcp_err(entry->pcb, nullptr);
+        tcp_abort(entry->pcb);
+        connections--;
+        delete entry;
+    }
+}
+
+// data arriving before the connection is attached is refused, lwip offers it again once the socket is set up
+err_t pending_recv_cb(void* arg, tcp_pcb* pcb, pbuf* p, err_t err)
+{
+    if (p)
+        return ERR_MEM;
+    reinterpret_cast<Listener::Pending*>(arg)->fin = true;
+    return ERR_OK;
+}
+
+void pending_err_cb(void* arg, err_t err)
+{
+    auto entry = reinterpret_cast<Listener::Pending*>(arg);
+    auto listener = entry->listener;
+
+    std::lock_guard lock(listener->mutex);
+    if (entry->taken) {
+        // js already has a socket for it, which is closed when it is attached
+        entry->err = err;
+        return;
+    }
+    // js never learns about connections that die in the queue
+    auto& pending = listener->pending;
+    pending.erase(std::find(pending.begin(), pending.end(), entry));
+    listener->connections--;
+    delete entry;
+}
+
+err_t accept_cb(void* arg, tcp_pcb* new_pcb, err_t err)
+{
+    auto listener = reinterpret_cast<ListenGroup*>(arg)->pick();
+
+    if (err != ERR_OK || ! new_pcb) {
+        listener->onConnection->NonBlockingCall(
+            [err](TSFN_ARGS) { jsCallback.Call({ ERROR("Accept error", err).Value() }); });
+        return ERR_OK;
+    }
+
+    std::lock_guard lock(listener->mutex);
+
+    if (listener->connections >= listener->max_connections || listener->pending.size() >= listener->backlog) {
+        // the new pcb has no callbacks yet, so this only sends a RST and frees it
+        tcp_abort(new_pcb);
+        listener->dropped++;
+        listener->wakeup();
+        return ERR_ABRT;
+    }
+
+    // delay accepting connection until its socket has been set up, this keeps it counted in lwip's backlog
+    tcp_backlog_delayed(new_pcb);
+
+    auto entry = new Listener::Pending{ listener, new_pcb, addr_info(new_pcb) };
+    tcp_arg(new_pcb, entry);
+    tcp_recv(new_pcb, pending_recv_cb);
+    tcp_err(new_pcb, pending_err_cb);
+
+    listener->connections++;
+    listener->pending.push_back(entry);
+    listener->wakeup();
+
+    return ERR_OK;
+}
+
 CLASS(Server)
 {
   public:
-    static Napi::FunctionReference* constructor;
+    static Napi::FunctionReference& constructor(Napi::Env env)
+    {
+        return addon_data(env).tcp_server;
+    }
 
     CLASS_INIT_DECL();
     CONSTRUCTOR(Server)
@@ -257,6 +1411,7 @@ CLASS(Server)
     }
 
     Napi::ThreadSafeFunction* onConnection;
+    std::shared_ptr<Listener> listener;
 
   private:
     tcp_pcb* pcb;
@@ -280,9 +1435,22 @@ CLASS(Server)
         if (onConnection)
             onConnection->Unref(env);
     }
-};
 
-Napi::FunctionReference* Server::constructor = new Napi::FunctionReference;
+    /**
+     * Sets the maximum number of open connections, further connections are aborted as soon as lwip accepts them.
+     *
+     * @param max { number } negative for no limit
+     */
+    VOID_METHOD(maxConnections)
+    {
+        NB_ARGS(1);
+        int64_t max = ARG_NUMBER(0).Int64Value();
+        if (listener)
+            listener->max_connections = max < 0 ? SIZE_MAX : max;
+    }
+
+    METHOD(connectionsInfo);
+};
 
 CLASS_INIT_IMPL(Server)
 {
@@ -294,52 +1462,33 @@ CLASS_INIT_IMPL(Server)
             CLASS_INSTANCE_METHOD(Server, close),
             CLASS_INSTANCE_METHOD(Server, ref),
             CLASS_INSTANCE_METHOD(Server, unref),
+            CLASS_INSTANCE_METHOD(Server, maxConnections),
+            CLASS_INSTANCE_METHOD(Server, connectionsInfo),
         });
 
-    *constructor = Napi::Persistent(ServerClass);
+    CLASS_SET_CONSTRUCTOR(ServerClass);
 
     EXPORT(Server, ServerClass);
     return exports;
 }
 
-err_t accept_cb(void* arg, tcp_pcb* new_pcb, err_t err)
-{
-    auto onConnection = reinterpret_cast<Napi::ThreadSafeFunction*>(arg);
-
-    // delay accepting connection until callback has been set up.
-    tcp_backlog_delayed(new_pcb);
-    int tsfnErr = onConnection->BlockingCall([err, new_pcb, addr = addr_info(new_pcb)](TSFN_ARGS) {
-        if (err < 0) {
-            jsCallback.Call({ ERROR("Accept error", err).Value() });
-            return;
-        }
-
-        auto socketObj = Socket::constructor->New({});
-        auto socket = Socket::Unwrap(socketObj);
-        socket->set_pcb(new_pcb);
-
-        jsCallback.Call({ UNDEFINED, socketObj, convert_addr_info(env, addr) });
-
-        socket->init(new_pcb);
-
-        // event handlers set in callback so now accept connection
-        typed_tcpip_callback([new_pcb]() { tcp_backlog_accepted(new_pcb); });
-    });
-    if (tsfnErr != napi_ok) {
-        tcp_close((tcp_pcb*)new_pcb->listener);
-        tcp_abort(new_pcb);
-        return ERR_ABRT;
-    }
-
-    return ERR_OK;
-}
-
+/**
+ * @param port { number }
+ * @param address { string } empty to listen on all addresses
+ * @param backlog { number } maximum number of connections waiting to be handed to js
+ * @param reusePort { boolean } share the listening pcb with other servers listening on the same address and port with
+ * reusePort, e.g. in worker threads. Connections are distributed among them.
+ * @param onConnection { (error, sockets, addrInfos, dropped) => void } called with every connection accepted since the
+ * last call and the number of connections dropped because of the backlog or the connection limit
+ */
 METHOD(Server::createServer)
 {
-    NB_ARGS(3);
+    NB_ARGS(5);
     int port = ARG_NUMBER(0);
     std::string address = ARG_STRING(1);
-    auto onConnection = ARG_FUNC(2);
+    int backlog = ARG_NUMBER(2);
+    bool reuse_port = ARG_BOOLEAN(3);
+    auto onConnection = ARG_FUNC(4);
 
     ip_addr_t ip_addr;
     if (address.size() == 0)
@@ -347,39 +1496,70 @@ METHOD(Server::createServer)
     else   // TODO error handling
         ipaddr_aton(address.c_str(), &ip_addr);
 
+    if (backlog < 1)
+        backlog = 1;
+
     auto onConnectionTsfn = TSFN_ONCE(onConnection, "TCP::onConnection");
+    auto listener = std::make_shared<Listener>(onConnectionTsfn, backlog);
+    listener->teardown_hook = env.AddCleanupHook(Listener::teardown, listener.get());
 
     return async_run(env, [&](DeferredPromise promise) {
-        typed_tcpip_callback(tsfn_once_tuple(
+        typed_tcpip_callback(async_once_tuple(
             env,
-            "Server::listen",
-            [port, ip_addr, onConnectionTsfn]() -> std::tuple<err_t, tcp_pcb*> {
+            [port, ip_addr, backlog, reuse_port, listener]() -> std::tuple<err_t, tcp_pcb*> {
+                // an ephemeral port is never shared
+                bool shared = reuse_port && port != 0;
+                auto key = std::make_pair(addr_to_binary(&ip_addr), (u16_t)port);
+
+                if (shared) {
+                    auto it = listen_groups.find(key);
+                    if (it != listen_groups.end()) {
+                        auto group = it->second;
+                        group->listeners.push_back(listener);
+                        listener->group = group;
+                        return { static_cast<err_t>(ERR_OK), group->pcb };
+                    }
+                }
+
                 auto pcb = tcp_new();
 
                 auto err = tcp_bind(pcb, &ip_addr, port);
                 if (err != ERR_OK) {
                     tcp_close(pcb);
-                    onConnectionTsfn->Release();
+                    listener->onConnection->Release();
                     return { err, nullptr };
                 }
-                tcp_arg(pcb, onConnectionTsfn);
 
-                pcb = tcp_listen(pcb);
+                auto group = new ListenGroup;
+                group->listeners.push_back(listener);
+                group->shared = shared;
+                group->key = key;
+                listener->group = group;
+                tcp_arg(pcb, group);
+
+                // lwip's own backlog also counts connections still in the handshake, SYNs beyond it are dropped
+                pcb = tcp_listen_with_backlog(pcb, std::min(backlog, 255));
                 tcp_accept(pcb, accept_cb);
+                group->pcb = pcb;
+
+                if (shared)
+                    listen_groups[key] = group;
 
                 return { static_cast<err_t>(ERR_OK), pcb };
             },
-            [promise, onConnectionTsfn](TSFN_ARGS, err_t err, tcp_pcb* pcb) {
-                // pcb, onConnectionTsfn are only valid if no err
+            [promise, listener](COMPLETION_ARGS, err_t err, tcp_pcb* pcb) {
+                // pcb is only valid if no err
 
                 if (err != ERR_OK) {
+                    listener->teardown_hook.Remove(env);
                     return promise->Reject(ERROR("failed to bind", err).Value());
                 }
                 else {
-                    auto serverObj = Server::constructor->New({});
+                    auto serverObj = Server::constructor(env).New({});
                     auto server = Server::Unwrap(serverObj);
                     server->pcb = pcb;
-                    server->onConnection = onConnectionTsfn;
+                    server->onConnection = listener->onConnection;
+                    server->listener = listener;
                     return promise->Resolve(serverObj);
                 }
             }));
@@ -400,6 +1580,54 @@ METHOD(Server::address)
     });
 }
 
+/**
+ * Snapshots every open connection accepted by this server in a single visit to the tcpip thread, one row of
+ * Socket.infoFields values per connection. Rows that don't fit are skipped, the returned count tells how large the
+ * arrays need to be.
+ *
+ * @param out { Float64Array } rows of info values
+ * @param addresses { Uint8Array } remote address of every row in binary representation
+ * @returns { Promise<number> } number of open connections, rows are only written for as many as fit in both arrays
+ */
+METHOD(Server::connectionsInfo)
+{
+    NB_ARGS(2);
+    auto out = info[0].As<Napi::Float64Array>();
+    auto addresses = ARG_UINT8ARRAY(1);
+    size_t capacity = std::min(out.ElementLength() / tcp_info_length, addresses.ByteLength() / BINARY_ADDR_LEN);
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once<size_t>(
+            env,
+            [listener = this->listener, rows = out.Data(), addrs = addresses.Data(), capacity]() -> size_t {
+                size_t count = 0;
+                if (! listener)
+                    return count;
+                for (auto pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+                    // connections still waiting in the accept queue have other callbacks and no socket yet
+                    if (pcb->recv != tcp_receive_cb)
+                        continue;
+                    auto socket = reinterpret_cast<Socket*>(pcb->callback_arg);
+                    if (socket->listener != listener)
+                        continue;
+                    if (count < capacity) {
+                        fill_tcp_info(pcb, rows + count * tcp_info_length);
+                        auto bin = addr_to_binary(&pcb->remote_ip);
+                        std::memcpy(addrs + count * BINARY_ADDR_LEN, bin.data(), BINARY_ADDR_LEN);
+                    }
+                    count++;
+                }
+                return count;
+            },
+            [outRef = ref_value(out), addressesRef = ref_uint8array(addresses), promise](COMPLETION_ARGS,
+                                                                                          size_t count) {
+                outRef->Reset();
+                addressesRef->Reset();
+                promise->Resolve(NUMBER(count));
+            }));
+    });
+}
+
 METHOD(Server::close)
 {
     NO_ARGS();
@@ -409,20 +1637,19 @@ METHOD(Server::close)
             return promise->Resolve(UNDEFINED);
         }
 
-        auto pcb = this->pcb;
         this->pcb = nullptr;
-
-        auto onConnection = this->onConnection;
         this->onConnection = nullptr;
+        auto listener = std::move(this->listener);
 
-        typed_tcpip_callback(tsfn_once_void(
+        typed_tcpip_callback(async_once_void(
             env,
-            "Server::close",
-            [pcb, onConnection]() {
-                tcp_close(pcb);
-                onConnection->Release();
-            },
-            [promise, onConnection](TSFN_ARGS) { promise->Resolve(UNDEFINED); }));
+            [listener]() { listener->leave_group(); },
+            [promise, listener](COMPLETION_ARGS) {
+                // removed only now, if the environment is torn down in the meantime the hook waits for the close
+                if (! listener->teardown_hook.IsEmpty())
+                    listener->teardown_hook.Remove(env);
+                promise->Resolve(UNDEFINED);
+            }));
     });
 }
 
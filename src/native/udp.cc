@@ -1,38 +1,190 @@
 #include "lwip/udp.h"
 
 #include "ZeroTierSockets.h"
+#include "addon.h"
 #include "lwip-util.h"
+#include "lwip/igmp.h"
+#include "lwip/mld6.h"
+#include "lwip/netif.h"
 #include "lwip/tcpip.h"
 #include "macros.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <napi.h>
+#include <string_view>
+#include <vector>
 
 namespace UDP {
 
 struct recv_data {
     pbuf* p;
-    char addr[ZTS_IP_MAX_STR_LEN];
+    ip_addr_t addr;
     u16_t port;
 };
-void tsfnOnRecv(TSFN_ARGS, nullptr_t* ctx, recv_data* rd);
+// datagram waiting to be delivered as part of a batch
+struct batch_entry {
+    pbuf* p;
+    ip_addr_t addr;
+    u16_t port;
+};
+
+/**
+ * Receive ring in a SharedArrayBuffer, written by the tcpip thread and read by js without any callbacks. The layout is
+ * shared with src/module/ring.ts: a header of int32 fields followed by `capacity` bytes of records. Each record is
+ * - length { uint32 } of the payload, RING_WRAP marks that the next record starts at the beginning of the data
+ * - address { 17 bytes } in binary representation
+ * - port { uint16 } at offset 22
+ * - the payload, padded to a multiple of 4 bytes
+ */
+#define RING_HEAD 0
+#define RING_TAIL 1
+#define RING_DROPPED 2
+#define RING_CAPACITY 3
+#define RING_SEQ 4
+#define RING_WAITING 5
+#define RING_HEADER_LEN 64
+#define RING_RECORD_HEADER_LEN 24
+#define RING_WRAP 0xffffffff
+
+struct RecvRing {
+    int32_t* header;
+    uint8_t* data;
+    uint32_t capacity;
+
+    std::atomic_ref<int32_t> field(int index)
+    {
+        return std::atomic_ref<int32_t>(header[index]);
+    }
+
+    // in lwip tcpip thread, returns false if the ring is full
+    bool push(pbuf* p, const ip_addr_t* addr, u16_t port)
+    {
+        uint32_t len = p->tot_len;
+        uint32_t need = (RING_RECORD_HEADER_LEN + len + 3) & ~3u;
+        uint32_t head = field(RING_HEAD).load(std::memory_order_relaxed);
+        uint32_t tail = field(RING_TAIL).load(std::memory_order_acquire);
+
+        // head never catches up with tail, they are only equal when the ring is empty
+        uint32_t pos;
+        if (head >= tail) {
+            if (capacity - head > need || (capacity - head == need && tail != 0)) {
+                pos = head;
+            }
+            else if (need < tail) {
+                *reinterpret_cast<uint32_t*>(data + head) = RING_WRAP;
+                pos = 0;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (head + need < tail) {
+            pos = head;
+        }
+        else {
+            return false;
+        }
+
+        uint8_t* record = data + pos;
+        *reinterpret_cast<uint32_t*>(record) = len;
+        auto bin = addr_to_binary(addr);
+        std::memcpy(record + 4, bin.data(), BINARY_ADDR_LEN);
+        *reinterpret_cast<uint16_t*>(record + 22) = port;
+        pbuf_copy_partial(p, record + RING_RECORD_HEADER_LEN, len, 0);
+
+        uint32_t next = pos + need;
+        field(RING_HEAD).store(next == capacity ? 0 : next, std::memory_order_release);
+        field(RING_SEQ).fetch_add(1);
+        return true;
+    }
+};
 
-using OnRecvTSFN = Napi::TypedThreadSafeFunction<nullptr_t, recv_data, tsfnOnRecv>;
+class Socket;
+struct BindGroup;
+void tsfnOnRecv(TSFN_ARGS, Socket* ctx, recv_data* rd);
+
+using OnRecvTSFN = Napi::TypedThreadSafeFunction<Socket, recv_data, tsfnOnRecv>;
 
 CLASS(Socket)
 {
   public:
-    static Napi::FunctionReference* constructor;
+    static Napi::FunctionReference& constructor(Napi::Env env)
+    {
+        return addon_data(env).udp_socket;
+    }
 
     CLASS_INIT_DECL();
     CONSTRUCTOR_DECL(Socket);
 
     OnRecvTSFN onRecv;
 
+    // datagrams handed to onRecv that js hasn't received yet
+    std::atomic<size_t> pending_bytes = 0;
+    std::atomic<size_t> pending_packets = 0;
+    // limits on pending datagrams, anything received beyond them is dropped
+    std::atomic<size_t> budget_bytes = 4 * 1024 * 1024;
+    std::atomic<size_t> budget_packets = 1024;
+    std::atomic<uint64_t> dropped_packets = 0;
+
+    // batched receive, enabled by setting a batch callback
+    std::atomic<bool> batched = false;
+    // whether the batch callback receives addresses in binary representation instead of as strings
+    bool binary_addresses = false;
+
+    // in lwip tcpip thread, queues a datagram for the next batch and wakes up the js thread if it isn't already
+    void queue_batch(pbuf * p, const ip_addr_t* addr, u16_t port);
+
+    // in js thread, delivers all queued datagrams in a single call of the batch callback
+    void deliver_batch(Napi::Env env);
+
+    // receive ring, only accessed in the tcpip thread once set
+    RecvRing* ring = nullptr;
+
+    // in lwip tcpip thread, writes a datagram to the ring and wakes up a waiting reader
+    void push_ring(pbuf * p, const ip_addr_t* addr, u16_t port);
+
+    // in js thread, handles a wakeup for batched receive or for a reader waiting on the ring
+    void wakeup(Napi::Env env);
+
+    // in lwip tcpip thread, hands a received datagram to js according to the receive mode
+    void receive(pbuf * p, const ip_addr_t* addr, u16_t port);
+
+    // shared pcb this socket is bound to, only accessed in the tcpip thread
+    BindGroup* group = nullptr;
+
+    // in lwip tcpip thread, takes the socket out of its bind group, the shared pcb is removed with the last socket
+    void leave_group();
+
+    // registered by a bind with reusePort. Hooks registered after the socket's tsfn run before it is torn down, so the
+    // socket leaves its group before the shared pcb could hand it another datagram.
+    Napi::Env::CleanupHook<void (*)(Socket*), Socket> teardown_hook;
+
+    // in js thread, when the environment is torn down without the socket being closed
+    static void teardown(Socket * socket);
+
+    ~Socket();
+
   private:
     udp_pcb* pcb;
 
+    Napi::FunctionReference batch_callback;
+    std::mutex batch_mutex;
+    std::vector<batch_entry> batch;
+    std::atomic<bool> batch_scheduled = false;
+
+    std::shared_ptr<Napi::Reference<Napi::Uint8Array> > ring_ref;
+    Napi::FunctionReference ring_notify;
+    std::atomic<bool> ring_wake_pending = false;
+
     METHOD(send);
+    METHOD(sendMany);
+    METHOD(sendSegments);
     METHOD(bind);
     METHOD(close);
 
@@ -40,7 +192,26 @@ CLASS(Socket)
     METHOD(remoteAddress);
 
     METHOD(connect);
+
+    METHOD(addMembership);
+    METHOD(dropMembership);
+    METHOD(setMulticastInterface);
+    VOID_METHOD(setMulticastTTL);
+    VOID_METHOD(setMulticastLoopback);
     VOID_METHOD(disconnect);
+    VOID_METHOD(recvBudget);
+    VOID_METHOD(setBatchCallback);
+    VOID_METHOD(setRing);
+    VOID_METHOD(binaryAddresses)
+    {
+        NB_ARGS(1);
+        binary_addresses = ARG_BOOLEAN(0);
+    }
+    METHOD(dropped)
+    {
+        NO_ARGS();
+        return NUMBER(dropped_packets);
+    }
     VOID_METHOD(ref)
     {
         NO_ARGS();
@@ -53,19 +224,29 @@ CLASS(Socket)
     }
 };
 
-Napi::FunctionReference* Socket::constructor = nullptr;
-
 CLASS_INIT_IMPL(Socket)
 {
     auto SocketClass = CLASS_DEFINE(
         Socket,
         { CLASS_INSTANCE_METHOD(Socket, send),
+          CLASS_INSTANCE_METHOD(Socket, sendMany),
+          CLASS_INSTANCE_METHOD(Socket, sendSegments),
           CLASS_INSTANCE_METHOD(Socket, bind),
           CLASS_INSTANCE_METHOD(Socket, close),
           CLASS_INSTANCE_METHOD(Socket, address),
           CLASS_INSTANCE_METHOD(Socket, remoteAddress),
           CLASS_INSTANCE_METHOD(Socket, connect),
+          CLASS_INSTANCE_METHOD(Socket, addMembership),
+          CLASS_INSTANCE_METHOD(Socket, dropMembership),
+          CLASS_INSTANCE_METHOD(Socket, setMulticastInterface),
+          CLASS_INSTANCE_METHOD(Socket, setMulticastTTL),
+          CLASS_INSTANCE_METHOD(Socket, setMulticastLoopback),
           CLASS_INSTANCE_METHOD(Socket, disconnect),
+          CLASS_INSTANCE_METHOD(Socket, recvBudget),
+          CLASS_INSTANCE_METHOD(Socket, setBatchCallback),
+          CLASS_INSTANCE_METHOD(Socket, setRing),
+          CLASS_INSTANCE_METHOD(Socket, binaryAddresses),
+          CLASS_INSTANCE_METHOD(Socket, dropped),
           CLASS_INSTANCE_METHOD(Socket, ref),
           CLASS_INSTANCE_METHOD(Socket, unref) });
 
@@ -75,20 +256,73 @@ CLASS_INIT_IMPL(Socket)
     return exports;
 }
 
-void lwip_recv_cb(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port)
+void Socket::receive(pbuf* p, const ip_addr_t* addr, u16_t port)
 {
-    auto thiz = reinterpret_cast<Socket*>(arg);
+    if (ring) {
+        push_ring(p, addr, port);
+        return;
+    }
+
+    // drop instead of queueing without limit while js is falling behind
+    if (pending_packets >= budget_packets || pending_bytes + p->tot_len > budget_bytes) {
+        dropped_packets++;
+        pbuf_free(p);
+        return;
+    }
+    pending_bytes += p->tot_len;
+    pending_packets++;
+
+    if (batched) {
+        queue_batch(p, addr, port);
+        return;
+    }
 
     recv_data* rd = new recv_data {};
     rd->p = p;
     rd->port = port;
-    ipaddr_ntoa_r(addr, rd->addr, ZTS_IP_MAX_STR_LEN);
+    ip_addr_copy(rd->addr, *addr);
 
-    thiz->onRecv.BlockingCall(rd);
+    if (onRecv.BlockingCall(rd) != napi_ok) {
+        pbuf_free(p);
+        delete rd;
+    }
 }
 
-void tsfnOnRecv(TSFN_ARGS, nullptr_t* ctx, recv_data* rd)
+void lwip_recv_cb(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port)
 {
+    reinterpret_cast<Socket*>(arg)->receive(p, addr, port);
+}
+
+/**
+ * Bound pcb shared by sockets in several environments (e.g. worker threads) that bound the same address and port with
+ * `reusePort`. Datagrams are distributed by their source address and port, so a flow sticks to one socket as long as no
+ * socket joins or leaves. Only accessed in the tcpip thread.
+ */
+struct BindGroup {
+    udp_pcb* pcb;
+    std::vector<Socket*> sockets;
+    std::pair<BinaryAddr, u16_t> key;
+};
+
+// shared pcbs by local address and port, only accessed in the tcpip thread
+std::map<std::pair<BinaryAddr, u16_t>, BindGroup*> bind_groups;
+
+void group_recv_cb(void* arg, struct udp_pcb* pcb, struct pbuf* p, const ip_addr_t* addr, u16_t port)
+{
+    auto group = reinterpret_cast<BindGroup*>(arg);
+    auto bin = addr_to_binary(addr);
+    size_t flow = std::hash<std::string_view>()(std::string_view((const char*)bin.data(), bin.size())) * 31 + port;
+    group->sockets[flow % group->sockets.size()]->receive(p, addr, port);
+}
+
+void tsfnOnRecv(TSFN_ARGS, Socket* ctx, recv_data* rd)
+{
+    // without data the call is a wakeup, queued datagrams are freed together with the socket
+    if (! rd) {
+        if (env != NULL)
+            ctx->wakeup(env);
+        return;
+    }
     if (env == NULL) {
         ts_pbuf_free(rd->p);
         delete rd;
@@ -96,12 +330,14 @@ void tsfnOnRecv(TSFN_ARGS, nullptr_t* ctx, recv_data* rd)
         return;
     }
     pbuf* p = rd->p;
+    ctx->pending_bytes -= p->tot_len;
+    ctx->pending_packets--;
 
     auto data = Napi::Uint8Array::New(env, p->tot_len);
     pbuf_copy_partial(p, data.Data(), p->tot_len, 0);
     ts_pbuf_free(p);
 
-    auto addr = STRING(rd->addr);
+    auto addr = address_cache(env).get(env, &rd->addr);
     auto port = NUMBER(rd->port);
 
     delete rd;
@@ -109,6 +345,157 @@ void tsfnOnRecv(TSFN_ARGS, nullptr_t* ctx, recv_data* rd)
     jsCallback.Call({ data, addr, port });
 }
 
+void Socket::push_ring(pbuf* p, const ip_addr_t* addr, u16_t port)
+{
+    bool pushed = ring->push(p, addr, port);
+    pbuf_free(p);
+
+    if (! pushed) {
+        ring->field(RING_DROPPED).fetch_add(1);
+        dropped_packets++;
+        return;
+    }
+
+    // a reader blocked in Atomics.wait can only be woken up from js
+    if (ring->field(RING_WAITING).load() && ! ring_wake_pending.exchange(true)) {
+        if (onRecv.BlockingCall(nullptr) != napi_ok)
+            ring_wake_pending = false;
+    }
+}
+
+void Socket::wakeup(Napi::Env env)
+{
+    if (ring_wake_pending.exchange(false))
+        ring_notify.Call({});
+    if (batched)
+        deliver_batch(env);
+}
+
+void Socket::queue_batch(pbuf* p, const ip_addr_t* addr, u16_t port)
+{
+    {
+        std::lock_guard lock(batch_mutex);
+        batch.push_back({ p, *addr, port });
+    }
+
+    if (! batch_scheduled.exchange(true)) {
+        if (onRecv.BlockingCall(nullptr) != napi_ok)
+            batch_scheduled = false;
+    }
+}
+
+/**
+ * Calls the batch callback with
+ * - data { Uint8Array } the payloads of all datagrams, back to back
+ * - table { Uint32Array } four entries per datagram: offset in data, length, port and index in addresses
+ * - addresses { string[] | Uint8Array } the distinct source addresses in the batch, as strings or, if binary addresses
+ * are enabled, packed in binary representation
+ */
+void Socket::deliver_batch(Napi::Env env)
+{
+    // datagrams queued from here on schedule a new wakeup
+    batch_scheduled = false;
+
+    std::vector<batch_entry> entries;
+    {
+        std::lock_guard lock(batch_mutex);
+        entries.swap(batch);
+    }
+    if (entries.empty())
+        return;
+
+    size_t total = 0;
+    for (auto& e : entries) {
+        total += e.p->tot_len;
+    }
+
+    auto data = Napi::Uint8Array::New(env, total);
+    auto table = Napi::Uint32Array::New(env, entries.size() * 4);
+    std::vector<const ip_addr_t*> addresses;
+
+    // addresses are converted once per batch, keyed by their binary representation
+    std::map<BinaryAddr, uint32_t> address_index;
+    std::vector<pbuf*> pbufs;
+    pbufs.reserve(entries.size());
+
+    size_t offset = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        auto& e = entries[i];
+
+        auto [it, inserted] = address_index.try_emplace(addr_to_binary(&e.addr), addresses.size());
+        if (inserted)
+            addresses.push_back(&e.addr);
+
+        u16_t len = e.p->tot_len;
+        pbuf_copy_partial(e.p, data.Data() + offset, len, 0);
+        pbufs.push_back(e.p);
+
+        table[i * 4] = offset;
+        table[i * 4 + 1] = len;
+        table[i * 4 + 2] = e.port;
+        table[i * 4 + 3] = it->second;
+        offset += len;
+    }
+    ts_pbuf_free_all(std::move(pbufs));
+
+    Napi::Value addrs;
+    if (binary_addresses) {
+        auto bin = Napi::Uint8Array::New(env, addresses.size() * BINARY_ADDR_LEN);
+        for (auto& [key, index] : address_index) {
+            std::memcpy(bin.Data() + index * BINARY_ADDR_LEN, key.data(), BINARY_ADDR_LEN);
+        }
+        addrs = bin;
+    }
+    else {
+        auto strs = Napi::Array::New(env, addresses.size());
+        for (uint32_t i = 0; i < addresses.size(); i++) {
+            strs[i] = address_cache(env).get(env, addresses[i]);
+        }
+        addrs = strs;
+    }
+
+    pending_bytes -= total;
+    pending_packets -= entries.size();
+
+    batch_callback.Call({ data, table, addrs });
+}
+
+void Socket::leave_group()
+{
+    auto group = this->group;
+    if (! group)
+        return;
+
+    // the shared pcb stays open while other sockets use it
+    auto& sockets = group->sockets;
+    sockets.erase(std::find(sockets.begin(), sockets.end(), this));
+    this->group = nullptr;
+    if (sockets.empty()) {
+        udp_remove(group->pcb);
+        bind_groups.erase(group->key);
+        delete group;
+    }
+}
+
+void Socket::teardown(Socket* socket)
+{
+    // the hook is freed once it has run
+    socket->teardown_hook = {};
+    tcpip_callback_sync([socket]() { socket->leave_group(); });
+}
+
+Socket::~Socket()
+{
+    delete ring;
+
+    std::vector<pbuf*> pbufs;
+    for (auto& e : batch) {
+        pbufs.push_back(e.p);
+    }
+    if (! pbufs.empty())
+        ts_pbuf_free_all(std::move(pbufs));
+}
+
 /**
  * @param ipv6 { bool } sets the type of the udp socket
  * @param recvCallback { (data: Uint8Array, addr: string, port: number)=>void }
@@ -120,7 +507,7 @@ Socket::CONSTRUCTOR(Socket)
     bool ipv6 = ARG_BOOLEAN(0);
     auto recvCallback = ARG_FUNC(1);
 
-    onRecv = OnRecvTSFN::New(env, recvCallback, "recvCallback", 0, 1, nullptr);
+    onRecv = OnRecvTSFN::New(env, recvCallback, "recvCallback", 0, 1, this);
 
     typed_tcpip_callback([this, ipv6]() {
         this->pcb = udp_new_ip_type(ipv6 ? IPADDR_TYPE_V6 : IPADDR_TYPE_V4);
@@ -133,17 +520,15 @@ METHOD(Socket::send)
 {
     NB_ARGS(3);
     auto data = ARG_UINT8ARRAY(0);
-    std::string addr = ARG_STRING(1);
     int port = ARG_NUMBER(2);
 
-    ip_addr_t ip_addr;
-    if (port)
-        ipaddr_aton(addr.c_str(), &ip_addr);
+    ip_addr_t ip_addr = {};
+    if (port && ! parse_addr(info[1], &ip_addr))
+        throw Napi::TypeError::New(env, "Invalid address");
 
     return async_run(env, [&](DeferredPromise promise) {
-        typed_tcpip_callback(tsfn_once<err_t>(
+        typed_tcpip_callback(async_once<err_t>(
             env,
-            "UDP::Socket::send",
             [this, port, ip_addr, len = data.ByteLength(), buffer = data.Data()]() {
                 struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_REF);
                 p->payload = buffer;
@@ -154,7 +539,7 @@ METHOD(Socket::send)
 
                 return err;
             },
-            [dataRef = ref_uint8array(data), promise](TSFN_ARGS, auto err) {
+            [dataRef = ref_uint8array(data), promise](COMPLETION_ARGS, auto err) {
                 dataRef->Reset();
                 if (err != ERR_OK)
                     promise->Reject(ERROR("send error", err).Value());
@@ -164,11 +549,161 @@ METHOD(Socket::send)
     });
 }
 
+/**
+ * Sends many datagrams in a single visit to the tcpip thread. Uses the same layout as batched receive, datagrams can
+ * share their payload, e.g. to send the same data to many peers.
+ *
+ * @param data { Uint8Array } payloads
+ * @param table { Uint32Array } four entries per datagram: offset in data, length, port and index in addresses. A port
+ * of 0 sends to the connected peer.
+ * @param addresses { string[] | Uint8Array } as strings or packed in binary representation
+ * @returns { Promise<Int32Array> } resolves with the lwip error code of every datagram
+ */
+METHOD(Socket::sendMany)
+{
+    NB_ARGS(3);
+    auto data = ARG_UINT8ARRAY(0);
+    auto table = info[1].As<Napi::Uint32Array>();
+    auto addresses = info[2];
+
+    if (table.ElementLength() % 4 != 0)
+        throw Napi::RangeError::New(env, "Table must have four entries per datagram");
+
+    std::vector<ip_addr_t> ip_addrs;
+    if (addresses.IsTypedArray()) {
+        auto bin = addresses.As<Napi::Uint8Array>();
+        ip_addrs.resize(bin.ByteLength() / BINARY_ADDR_LEN);
+        for (size_t i = 0; i < ip_addrs.size(); i++) {
+            if (! binary_to_addr(bin.Data() + i * BINARY_ADDR_LEN, &ip_addrs[i]))
+                throw Napi::TypeError::New(env, "Invalid address");
+        }
+    }
+    else {
+        auto strs = addresses.As<Napi::Array>();
+        ip_addrs.resize(strs.Length());
+        for (uint32_t i = 0; i < strs.Length(); i++) {
+            if (! parse_addr(strs.Get(i), &ip_addrs[i]))
+                throw Napi::TypeError::New(env, "Invalid address");
+        }
+    }
+
+    struct datagram {
+        uint32_t offset;
+        uint32_t length;
+        u16_t port;
+        uint32_t addr;
+    };
+    std::vector<datagram> datagrams(table.ElementLength() / 4);
+    for (size_t i = 0; i < datagrams.size(); i++) {
+        datagram d { table[i * 4], table[i * 4 + 1], (u16_t)table[i * 4 + 2], table[i * 4 + 3] };
+        if ((size_t)d.offset + d.length > data.ByteLength() || d.length > 0xffff
+            || (d.port && d.addr >= ip_addrs.size()))
+            throw Napi::RangeError::New(env, "Datagram out of range");
+        datagrams[i] = d;
+    }
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once<std::vector<err_t> >(
+            env,
+            [this, datagrams = std::move(datagrams), ip_addrs = std::move(ip_addrs), buffer = data.Data()]() {
+                std::vector<err_t> errors;
+                errors.reserve(datagrams.size());
+                for (auto& d : datagrams) {
+                    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, d.length, PBUF_REF);
+                    if (! p) {
+                        errors.push_back(ERR_MEM);
+                        continue;
+                    }
+                    p->payload = buffer + d.offset;
+
+                    errors.push_back(d.port ? udp_sendto(this->pcb, p, &ip_addrs[d.addr], d.port)
+                                            : udp_send(this->pcb, p));
+
+                    pbuf_free(p);
+                }
+                return errors;
+            },
+            [dataRef = ref_uint8array(data), promise](COMPLETION_ARGS, auto errors) {
+                dataRef->Reset();
+                auto result = Napi::Int32Array::New(env, errors.size());
+                for (size_t i = 0; i < errors.size(); i++) {
+                    result[i] = errors[i];
+                }
+                promise->Resolve(result);
+            }));
+    });
+}
+
+/**
+ * Splits `data` into datagrams of `segmentSize` bytes, the last one possibly shorter, and sends them to the same
+ * destination in a single visit to the tcpip thread. Sending stops at the first error.
+ *
+ * @param data { Uint8Array }
+ * @param segmentSize { number }
+ * @param addr { string | Uint8Array }
+ * @param port { number } 0 sends to the connected peer
+ * @returns { Promise<void> } rejects with the lwip error code and the number of segments that were sent
+ */
+METHOD(Socket::sendSegments)
+{
+    NB_ARGS(4);
+    auto data = ARG_UINT8ARRAY(0);
+    int64_t segment_size = ARG_NUMBER(1).Int64Value();
+    int port = ARG_NUMBER(3);
+
+    if (segment_size < 1 || segment_size > 0xffff)
+        throw Napi::RangeError::New(env, "Invalid segment size");
+
+    ip_addr_t ip_addr = {};
+    if (port && ! parse_addr(info[2], &ip_addr))
+        throw Napi::TypeError::New(env, "Invalid address");
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once<std::pair<err_t, size_t> >(
+            env,
+            [this, port, ip_addr, segment_size, len = data.ByteLength(), buffer = data.Data()]() {
+                size_t sent = 0;
+                for (size_t offset = 0; offset < len; offset += segment_size) {
+                    u16_t segment = (u16_t)LWIP_MIN((size_t)segment_size, len - offset);
+                    struct pbuf* p = pbuf_alloc(PBUF_TRANSPORT, segment, PBUF_REF);
+                    if (! p)
+                        return std::make_pair((err_t)ERR_MEM, sent);
+                    p->payload = buffer + offset;
+
+                    err_t err = port ? udp_sendto(this->pcb, p, &ip_addr, port) : udp_send(this->pcb, p);
+                    pbuf_free(p);
+                    if (err != ERR_OK)
+                        return std::make_pair(err, sent);
+                    sent++;
+                }
+                return std::make_pair((err_t)ERR_OK, sent);
+            },
+            [dataRef = ref_uint8array(data), promise](COMPLETION_ARGS, auto result) {
+                dataRef->Reset();
+                auto [err, sent] = result;
+                if (err != ERR_OK)
+                    promise->Reject(MAKE_ERROR("send error", {
+                                        ERR_FIELD("code", NUMBER(err));
+                                        ERR_FIELD("sent", NUMBER(sent));
+                                    }).Value());
+                else
+                    promise->Resolve(UNDEFINED);
+            }));
+    });
+}
+
+/**
+ * @param addr { string } empty to bind to all addresses
+ * @param port { number }
+ * @param reusePort { boolean | undefined } share the pcb with other sockets bound to the same address and port with
+ * reusePort, e.g. in worker threads. Received datagrams are distributed among them by flow.
+ */
 METHOD(Socket::bind)
 {
     NB_ARGS(2);
     std::string addr = ARG_STRING(0);
     int port = ARG_NUMBER(1);
+    bool reuse_port = info.Length() > 2 && ARG_BOOLEAN(2);
 
     ip_addr_t ip_addr;
 
@@ -177,12 +712,42 @@ METHOD(Socket::bind)
     else
         ipaddr_aton(addr.c_str(), &ip_addr);
 
+    // the shared pcb refers to the socket until it is closed, so it can't be collected before that
+    if (reuse_port && port != 0 && teardown_hook.IsEmpty()) {
+        teardown_hook = env.AddCleanupHook(teardown, this);
+        Ref();
+    }
+
     return async_run(env, [&](DeferredPromise promise) {
-        typed_tcpip_callback(tsfn_once<err_t>(
+        typed_tcpip_callback(async_once<err_t>(
             env,
-            "UDP::Socket::bind",
-            [this, ip_addr, port]() { return udp_bind(this->pcb, &ip_addr, port); },
-            [promise](TSFN_ARGS, auto err) {
+            [this, ip_addr, port, reuse_port]() -> err_t {
+                // an ephemeral port is never shared
+                bool shared = reuse_port && port != 0;
+                auto key = std::make_pair(addr_to_binary(&ip_addr), (u16_t)port);
+
+                if (shared) {
+                    auto it = bind_groups.find(key);
+                    if (it != bind_groups.end()) {
+                        // the shared pcb replaces this socket's own
+                        udp_remove(this->pcb);
+                        this->pcb = it->second->pcb;
+                        this->group = it->second;
+                        this->group->sockets.push_back(this);
+                        return ERR_OK;
+                    }
+                }
+
+                auto err = udp_bind(this->pcb, &ip_addr, port);
+                if (err != ERR_OK || ! shared)
+                    return err;
+
+                this->group = new BindGroup { this->pcb, { this }, key };
+                udp_recv(this->pcb, group_recv_cb, this->group);
+                bind_groups[key] = this->group;
+                return ERR_OK;
+            },
+            [promise](COMPLETION_ARGS, auto err) {
                 if (err != ERR_OK)
                     promise->Reject(ERROR("Bind error", err).Value());
                 else
@@ -200,14 +765,22 @@ METHOD(Socket::close)
             auto old_pcb = pcb;
             pcb = nullptr;
 
-            typed_tcpip_callback(tsfn_once_void(
+            typed_tcpip_callback(async_once_void(
                 env,
-                "UDP::Socket::close",
-                [old_pcb]() {
+                [this, old_pcb]() {
                     LWIP_ASSERT("pcb was null", old_pcb != nullptr);
-                    udp_remove(old_pcb);
+                    if (! this->group) {
+                        udp_remove(old_pcb);
+                        return;
+                    }
+                    this->leave_group();
                 },
-                [this, promise](TSFN_ARGS) {
+                [this, promise](COMPLETION_ARGS) {
+                    // removed only now, if the environment is torn down in the meantime the hook waits for the close
+                    if (! this->teardown_hook.IsEmpty()) {
+                        this->teardown_hook.Remove(env);
+                        this->Unref();
+                    }
                     this->onRecv.Abort();
                     promise->Resolve(UNDEFINED);
                 }));
@@ -251,19 +824,22 @@ METHOD(Socket::remoteAddress)
 METHOD(Socket::connect)
 {
     NB_ARGS(2);
-
-    std::string address = ARG_STRING(0);
     int port = ARG_NUMBER(1);
 
     ip_addr_t addr;
-    ipaddr_aton(address.c_str(), &addr);
+    if (! parse_addr(info[0], &addr))
+        throw Napi::TypeError::New(env, "Invalid address");
 
     return async_run(env, [&](DeferredPromise promise) {
-        typed_tcpip_callback(tsfn_once<err_t>(
+        typed_tcpip_callback(async_once<err_t>(
             env,
-            "UDP::Socket::connect",
-            [this, addr, port]() { return udp_connect(this->pcb, &addr, port); },
-            [promise](TSFN_ARGS, auto err) {
+            [this, addr, port]() -> err_t {
+                // connecting would redirect the datagrams of every socket sharing the pcb
+                if (this->group)
+                    return ERR_VAL;
+                return udp_connect(this->pcb, &addr, port);
+            },
+            [promise](COMPLETION_ARGS, auto err) {
                 if (err != ERR_OK)
                     promise->Reject(ERROR("Connect error", err).Value());
                 else
@@ -277,4 +853,219 @@ VOID_METHOD(Socket::disconnect)
     typed_tcpip_callback([pcb = this->pcb]() { udp_disconnect(pcb); });
 }
 
+// in lwip tcpip thread, joins or leaves `group` on the interface with address `iface`, or on all interfaces if it is
+// the any address
+err_t join_group(bool join, const ip_addr_t& group, const ip_addr_t& iface)
+{
+    if (IP_IS_V6(&group)) {
+#if LWIP_IPV6_MLD
+        return join ? mld6_joingroup(ip_2_ip6(&iface), ip_2_ip6(&group))
+                    : mld6_leavegroup(ip_2_ip6(&iface), ip_2_ip6(&group));
+#else
+        return ERR_VAL;
+#endif
+    }
+#if LWIP_IGMP
+    return join ? igmp_joingroup(ip_2_ip4(&iface), ip_2_ip4(&group))
+                : igmp_leavegroup(ip_2_ip4(&iface), ip_2_ip4(&group));
+#else
+    return ERR_VAL;
+#endif
+}
+
+Napi::Promise membership(CALLBACKINFO, bool join)
+{
+    NB_ARGS(1);
+
+    ip_addr_t group;
+    if (! parse_addr(info[0], &group) || ! ip_addr_ismulticast(&group))
+        throw Napi::TypeError::New(env, "Invalid multicast address");
+
+    ip_addr_t iface;
+    if (info.Length() > 1 && ! info[1].IsUndefined()) {
+        if (! parse_addr(info[1], &iface) || IP_GET_TYPE(&iface) != IP_GET_TYPE(&group))
+            throw Napi::TypeError::New(env, "Invalid interface address");
+    }
+    else if (IP_IS_V6(&group)) {
+        ip_addr_copy(iface, *IP6_ADDR_ANY);
+    }
+    else {
+        ip_addr_copy(iface, *IP4_ADDR_ANY);
+    }
+
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once<err_t>(
+            env,
+            [join, group, iface]() { return join_group(join, group, iface); },
+            [promise, join](COMPLETION_ARGS, auto err) {
+                if (err != ERR_OK)
+                    promise->Reject(ERROR(join ? "addMembership error" : "dropMembership error", err).Value());
+                else
+                    promise->Resolve(UNDEFINED);
+            }));
+    });
+}
+
+/**
+ * Joins a multicast group, IGMP for IPv4 and MLD for IPv6 groups.
+ *
+ * @param group { string | Uint8Array } multicast address
+ * @param iface { string | Uint8Array | undefined } address of the interface to join on, all interfaces if undefined
+ * @returns { Promise<void> }
+ */
+METHOD(Socket::addMembership)
+{
+    return membership(info, true);
+}
+
+/**
+ * Leaves a multicast group joined with addMembership, takes the same arguments.
+ */
+METHOD(Socket::dropMembership)
+{
+    return membership(info, false);
+}
+
+/**
+ * Sets the interface outgoing multicast datagrams are sent on.
+ *
+ * @param iface { string | Uint8Array } address of the interface
+ * @returns { Promise<void> } rejects with ERR_VAL if no interface has that address
+ */
+METHOD(Socket::setMulticastInterface)
+{
+    NB_ARGS(1);
+    ip_addr_t iface;
+    if (! parse_addr(info[0], &iface))
+        throw Napi::TypeError::New(env, "Invalid interface address");
+
+#if LWIP_MULTICAST_TX_OPTIONS
+    return async_run(env, [&](DeferredPromise promise) {
+        typed_tcpip_callback(async_once<err_t>(
+            env,
+            [this, iface]() {
+                netif* n;
+                NETIF_FOREACH(n)
+                {
+                    bool match = IP_IS_V6(&iface) ? netif_get_ip6_addr_match(n, ip_2_ip6(&iface)) >= 0
+                                                  : ip4_addr_cmp(netif_ip4_addr(n), ip_2_ip4(&iface));
+                    if (match) {
+                        udp_set_multicast_netif_index(this->pcb, netif_get_index(n));
+                        return ERR_OK;
+                    }
+                }
+                return ERR_VAL;
+            },
+            [promise](COMPLETION_ARGS, auto err) {
+                if (err != ERR_OK)
+                    promise->Reject(ERROR("setMulticastInterface error", err).Value());
+                else
+                    promise->Resolve(UNDEFINED);
+            }));
+    });
+#else
+    throw Napi::Error::New(env, "Multicast options not supported");
+#endif
+}
+
+/**
+ * @param ttl { number } hop limit of outgoing multicast datagrams
+ */
+VOID_METHOD(Socket::setMulticastTTL)
+{
+    NB_ARGS(1);
+    int ttl = ARG_NUMBER(0);
+    if (ttl < 0 || ttl > 255)
+        throw Napi::RangeError::New(env, "TTL must be between 0 and 255");
+
+#if LWIP_MULTICAST_TX_OPTIONS
+    typed_tcpip_callback([pcb = this->pcb, ttl]() { udp_set_multicast_ttl(pcb, ttl); });
+#else
+    throw Napi::Error::New(env, "Multicast options not supported");
+#endif
+}
+
+/**
+ * @param enable { boolean } whether outgoing multicast datagrams are looped back to local members of the group
+ */
+VOID_METHOD(Socket::setMulticastLoopback)
+{
+    NB_ARGS(1);
+    bool enable = ARG_BOOLEAN(0);
+
+#if LWIP_MULTICAST_TX_OPTIONS
+    typed_tcpip_callback([pcb = this->pcb, enable]() {
+        if (enable)
+            udp_setflags(pcb, udp_flags(pcb) | UDP_FLAGS_MULTICAST_LOOP);
+        else
+            udp_setflags(pcb, udp_flags(pcb) & ~UDP_FLAGS_MULTICAST_LOOP);
+    });
+#else
+    throw Napi::Error::New(env, "Multicast options not supported");
+#endif
+}
+
+/**
+ * Switches the socket to batched receive: datagrams that arrive while the js thread is busy are delivered together in a
+ * single call of `callback` instead of one call of the receive callback per datagram, see deliver_batch.
+ *
+ * @param callback { (data: Uint8Array, table: Uint32Array, addresses: string[]) => void }
+ */
+VOID_METHOD(Socket::setBatchCallback)
+{
+    NB_ARGS(1);
+    batch_callback = Napi::Persistent(ARG_FUNC(0));
+    batched = true;
+}
+
+/**
+ * Switches the socket to writing received datagrams to a ring in shared memory instead of calling any callbacks, see
+ * RecvRing. The ring can't be changed once set.
+ *
+ * @param view { Uint8Array } view on the whole SharedArrayBuffer, with the capacity already set in the header
+ * @param notify { () => void } called in the js thread when a reader is waiting and datagrams were written, should
+ * Atomics.notify the reader
+ */
+VOID_METHOD(Socket::setRing)
+{
+    NB_ARGS(2);
+    auto view = ARG_UINT8ARRAY(0);
+    auto notify = ARG_FUNC(1);
+
+    if (ring_ref)
+        throw Napi::Error::New(env, "Ring already set");
+    if ((uintptr_t)view.Data() % 4 != 0 || view.ByteLength() < RING_HEADER_LEN)
+        throw Napi::RangeError::New(env, "Invalid ring");
+
+    auto header = reinterpret_cast<int32_t*>(view.Data());
+    uint32_t capacity = header[RING_CAPACITY];
+    if (capacity % 4 != 0 || capacity < RING_RECORD_HEADER_LEN || RING_HEADER_LEN + capacity > view.ByteLength())
+        throw Napi::RangeError::New(env, "Invalid ring capacity");
+
+    ring_ref = ref_uint8array(view);
+    ring_notify = Napi::Persistent(notify);
+
+    auto ring = new RecvRing { header, view.Data() + RING_HEADER_LEN, capacity };
+    typed_tcpip_callback([this, ring]() { this->ring = ring; });
+}
+
+/**
+ * Limits the datagrams that can be waiting for the js thread, datagrams received beyond the limits are dropped and
+ * counted, see dropped.
+ *
+ * @param bytes { number }
+ * @param packets { number }
+ */
+VOID_METHOD(Socket::recvBudget)
+{
+    NB_ARGS(2);
+    int64_t bytes = ARG_NUMBER(0).Int64Value();
+    int64_t packets = ARG_NUMBER(1).Int64Value();
+    if (bytes < 1 || packets < 1)
+        throw Napi::RangeError::New(env, "Invalid receive budget");
+
+    budget_bytes = bytes;
+    budget_packets = packets;
+}
+
 }   // namespace UDP
@@ -0,0 +1,771 @@
+import { setTimeout } from "timers/promises";
+import { isMainThread, threadId, Worker } from "worker_threads";
+
+import { dgram, net, node } from "../index";
+
+const arg = (index: number) => process.argv[index];
+const argIndex = (arg: string) => process.argv.indexOf(arg);
+const flag = (name: string) => argIndex(name) >= 0;
+const option = (name: string, fallback: number) =>
+  argIndex(name) < 0 ? fallback : parseFloat(arg(argIndex(name) + 1));
+
+const report = (result: Record<string, unknown>) =>
+  console.log(JSON.stringify(result));
+
+/**
+ * Server sends `size` MB, client receives it and reports throughput.
+ */
+async function tcpRecv(server: boolean, host: string, port: number) {
+  const size = option("size", 100) * 1_000_000;
+  const zeroCopyReceive = flag("zerocopy");
+  const receiveChunkSize = option("chunk", 64 * 1024);
+
+  if (server) {
+    const chunk = Buffer.alloc(64 * 1024, 0x61);
+    const srv = net.createServer((socket) => {
+      let remaining = size;
+      const write = () => {
+        while (remaining > 0) {
+          const piece = chunk.subarray(0, Math.min(remaining, chunk.length));
+          remaining -= piece.length;
+          if (!socket.write(piece)) return socket.once("drain", write);
+        }
+        socket.end();
+      };
+      write();
+    });
+    srv.listen(port, () => console.log(srv.address()));
+    return;
+  }
+
+  const socket = net.connect({
+    port,
+    host,
+    zeroCopyReceive,
+    receiveChunkSize,
+  });
+  let received = 0;
+  let start = BigInt(0);
+  socket.on("connect", () => (start = process.hrtime.bigint()));
+  socket.on("data", (data: Uint8Array) => (received += data.length));
+  socket.on("end", () => {
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+    report({
+      bench: "tcp-recv",
+      mode: zeroCopyReceive ? "zerocopy" : "copy",
+      chunk: receiveChunkSize,
+      bytes: received,
+      seconds,
+      MBps: received / 1e6 / seconds,
+      rss: process.memoryUsage.rss(),
+    });
+    node.free();
+  });
+}
+
+/**
+ * Server writes to every connection as fast as it can, client opens `conns` connections that each read a single chunk
+ * every `interval` ms and reports memory usage after `duration` seconds.
+ */
+async function tcpSlowReaders(server: boolean, host: string, port: number) {
+  const conns = option("conns", 100);
+  const interval = option("interval", 100);
+  const duration = option("duration", 10);
+
+  if (server) {
+    const chunk = Buffer.alloc(16 * 1024, 0x61);
+    const srv = net.createServer((socket) => {
+      let open = true;
+      socket.on("error", () => (open = false));
+      socket.on("close", () => (open = false));
+      const write = () => {
+        while (open && socket.write(chunk));
+        if (open) socket.once("drain", write);
+      };
+      write();
+    });
+    srv.listen(port, () => console.log(srv.address()));
+    return;
+  }
+
+  const sockets = [];
+  for (let i = 0; i < conns; i++) {
+    const socket = net.connect({ port, host });
+    socket.on("error", () => undefined);
+    sockets.push(socket);
+  }
+
+  let received = 0;
+  const reader = setInterval(() => {
+    for (const socket of sockets) {
+      const chunk: Uint8Array | null = socket.read();
+      if (chunk) received += chunk.length;
+    }
+  }, interval);
+
+  await setTimeout(duration * 1000);
+  clearInterval(reader);
+
+  const memory = process.memoryUsage();
+  report({
+    bench: "tcp-slow-readers",
+    conns,
+    interval,
+    received,
+    rss: memory.rss,
+    heapUsed: memory.heapUsed,
+    external: memory.external,
+    arrayBuffers: memory.arrayBuffers,
+    rssPerConn: memory.rss / conns,
+  });
+
+  for (const socket of sockets) socket.destroy();
+  node.free();
+}
+
+/**
+ * Client opens `count` connections with at most `parallel` connecting at once and closes each as soon as it is
+ * established, then reports connections per second. Server accepts with the given backlog and connection limit and
+ * reports accepted and dropped connections every second. With `workers`, the server additionally listens on the same
+ * port in that many worker threads.
+ */
+async function tcpAccept(server: boolean, host: string, port: number) {
+  const count = option("count", 10_000);
+  const parallel = option("parallel", 256);
+  const workers = option("workers", 0);
+
+  if (server) {
+    if (isMainThread) {
+      for (let i = 0; i < workers; i++)
+        new Worker(__filename, { argv: process.argv.slice(2) });
+    }
+
+    let accepted = 0;
+    let dropped = 0;
+    const srv = net.createServer((socket) => {
+      accepted++;
+      socket.on("error", () => undefined);
+      socket.end();
+    });
+    srv.maxConnections = option("max", Infinity);
+    srv.on("drop", () => dropped++);
+    const backlog = option("backlog", 511);
+    srv.listen({ port, backlog, reusePort: workers > 0 }, () =>
+      console.log(srv.address()),
+    );
+    setInterval(() => {
+      report({
+        bench: "tcp-accept",
+        thread: threadId,
+        accepted,
+        dropped,
+        rss: process.memoryUsage.rss(),
+      });
+      accepted = dropped = 0;
+    }, 1000);
+    return;
+  }
+
+  let started = 0;
+  let connected = 0;
+  let failed = 0;
+  const start = process.hrtime.bigint();
+
+  await new Promise<void>((resolve) => {
+    const next = () => {
+      if (connected + failed === count) return resolve();
+      if (started === count) return;
+      started++;
+      const socket = net.connect({ port, host });
+      socket.once("connect", () => {
+        connected++;
+        socket.destroy();
+        next();
+      });
+      socket.once("error", () => {
+        failed++;
+        next();
+      });
+    };
+    for (let i = 0; i < Math.min(parallel, count); i++) next();
+  });
+
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+  report({
+    bench: "tcp-accept",
+    count,
+    parallel,
+    connected,
+    failed,
+    seconds,
+    connsPerSecond: connected / seconds,
+  });
+  node.free();
+}
+
+/**
+ * Client opens `conns` connections, with at most `parallel` connecting at once, that stay idle with an idle timeout of
+ * `timeout` ms each. It then reports memory per connection, the cpu time spent over `duration` seconds and the number of
+ * timeouts that fired. With `jstimers`, every connection uses a js timer instead of the socket's native timeout. Server
+ * accepts and never writes.
+ */
+async function tcpIdle(server: boolean, host: string, port: number) {
+  const conns = option("conns", 50_000);
+  const parallel = option("parallel", 256);
+  const timeout = option("timeout", 60_000);
+  const duration = option("duration", 10);
+  const jsTimers = flag("jstimers");
+
+  if (server) {
+    let open = 0;
+    const srv = net.createServer((socket) => {
+      open++;
+      socket.on("error", () => undefined);
+      socket.on("close", () => open--);
+    });
+    srv.listen({ port, backlog: parallel }, () => console.log(srv.address()));
+    setInterval(() => {
+      report({ bench: "tcp-idle", open, rss: process.memoryUsage.rss() });
+    }, 1000);
+    return;
+  }
+
+  const rssBefore = process.memoryUsage.rss();
+  const sockets: ReturnType<typeof net.connect>[] = [];
+  let timeouts = 0;
+  let failed = 0;
+
+  await new Promise<void>((resolve) => {
+    let started = 0;
+    const next = () => {
+      if (sockets.length + failed === conns) return resolve();
+      if (started === conns) return;
+      started++;
+      const socket = net.connect({ port, host });
+      socket.once("connect", () => {
+        sockets.push(socket);
+        if (jsTimers) {
+          const timer = global.setTimeout(() => {
+            timeouts++;
+            timer.refresh();
+          }, timeout);
+          socket.once("close", () => clearTimeout(timer));
+        } else {
+          socket.setTimeout(timeout);
+          socket.on("timeout", () => timeouts++);
+        }
+        next();
+      });
+      socket.once("error", () => {
+        failed++;
+        next();
+      });
+    };
+    for (let i = 0; i < Math.min(parallel, conns); i++) next();
+  });
+
+  const rss = process.memoryUsage.rss();
+  const cpu = process.cpuUsage();
+  await setTimeout(duration * 1000);
+  const { user, system } = process.cpuUsage(cpu);
+
+  report({
+    bench: "tcp-idle",
+    mode: jsTimers ? "jstimers" : "native",
+    conns: sockets.length,
+    failed,
+    timeout,
+    duration,
+    timeouts,
+    rss,
+    rssPerConn: (rss - rssBefore) / sockets.length,
+    cpuUserMs: user / 1e3,
+    cpuSystemMs: system / 1e3,
+  });
+
+  sockets.forEach((socket) => socket.destroy());
+  node.free();
+}
+
+/**
+ * Client sends `count` datagrams of `size` bytes with at most `window` sends in flight and reports the send rate and
+ * the average time until a send completes. Server only receives.
+ */
+async function udpSend(server: boolean, host: string, port: number) {
+  const count = option("count", 100_000);
+  const size = option("size", 64);
+  const window = option("window", 64);
+
+  if (server) {
+    let received = 0;
+    const socket = dgram.createSocket({ type: "udp6" }, () => received++);
+    socket.bind(port, undefined, () => console.log(socket.address()));
+    setInterval(() => console.log(`received ${received}`), 1000);
+    return;
+  }
+
+  const socket = dgram.createSocket({ type: "udp6" });
+  const msg = Buffer.alloc(size, 0x61);
+
+  let sent = 0;
+  let latency = BigInt(0);
+  const start = process.hrtime.bigint();
+  await new Promise<void>((resolve) => {
+    let started = 0;
+    const sendOne = () => {
+      const t = process.hrtime.bigint();
+      started++;
+      socket.send(msg, port, host, () => {
+        latency += process.hrtime.bigint() - t;
+        if (++sent === count) resolve();
+        else if (started < count) sendOne();
+      });
+    };
+    for (let i = 0; i < Math.min(window, count); i++) sendOne();
+  });
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+  report({
+    bench: "udp-send",
+    count,
+    size,
+    window,
+    seconds,
+    pps: count / seconds,
+    avgLatencyUs: Number(latency / BigInt(count)) / 1e3,
+    rss: process.memoryUsage.rss(),
+  });
+  socket.close(() => node.free());
+}
+
+/**
+ * Sends datagrams of `size` bytes to `host` as fast as possible for `duration` seconds.
+ */
+async function flood(
+  host: string,
+  port: number,
+  size: number,
+  duration: number,
+) {
+  const socket = dgram.createSocket({ type: "udp6" });
+  const msg = Buffer.alloc(size, 0x61);
+  const end = Date.now() + duration * 1000;
+  let inFlight = 0;
+  await new Promise<void>((resolve) => {
+    const send = () => {
+      while (inFlight < 256 && Date.now() < end) {
+        inFlight++;
+        socket.send(msg, port, host, () => {
+          inFlight--;
+          send();
+        });
+      }
+      if (inFlight === 0) resolve();
+    };
+    send();
+  });
+  socket.close(() => node.free());
+}
+
+/**
+ * Client floods the server with datagrams for `duration` seconds, server reports received datagrams per second, either
+ * through per-datagram "message" events or, with `batch`, through "batch" events.
+ */
+async function udpRecv(server: boolean, host: string, port: number) {
+  const size = option("size", 64);
+  const duration = option("duration", 10);
+  const batch = flag("batch");
+  const ring = flag("ring");
+
+  if (!server) return flood(host, port, size, duration);
+
+  let received = 0;
+  let batches = 0;
+  const socket = dgram.createSocket({ type: "udp6", batch });
+  if (ring) {
+    const recvRing = new dgram.RecvRing(option("capacity", 4 * 1024 * 1024));
+    socket.setRing(recvRing);
+    const poll = () => {
+      received += recvRing.poll(() => undefined);
+      setImmediate(poll);
+    };
+    poll();
+  } else if (batch)
+    socket.on("batch", (_data, table) => {
+      received += table.length / 4;
+      batches++;
+    });
+  else socket.on("message", () => received++);
+  socket.bind(port, undefined, () => console.log(socket.address()));
+
+  let last = process.hrtime.bigint();
+  setInterval(() => {
+    const now = process.hrtime.bigint();
+    const seconds = Number(now - last) / 1e9;
+    report({
+      bench: "udp-recv",
+      mode: ring ? "ring" : batch ? "batch" : "message",
+      size,
+      pps: received / seconds,
+      perBatch: batch ? received / batches : 1,
+      dropped: socket.droppedMessages,
+      rss: process.memoryUsage.rss(),
+    });
+    received = 0;
+    batches = 0;
+    last = now;
+  }, 1000);
+}
+
+/**
+ * Client floods the server with datagrams for `duration` seconds. Server blocks its event loop for `stall` ms out of
+ * every second to simulate a consumer that falls behind and reports received and dropped datagrams and memory usage
+ * every second, which should stay flat.
+ */
+async function udpFlood(server: boolean, host: string, port: number) {
+  const size = option("size", 1024);
+  const duration = option("duration", 10);
+  const stall = option("stall", 500);
+
+  if (server) {
+    let received = 0;
+    const socket = dgram.createSocket({ type: "udp6" }, () => received++);
+    socket.bind(port, undefined, () => console.log(socket.address()));
+    setInterval(() => {
+      const until = Date.now() + stall;
+      while (Date.now() < until);
+      report({
+        bench: "udp-flood",
+        received,
+        dropped: socket.droppedMessages,
+        rss: process.memoryUsage.rss(),
+      });
+    }, 1000);
+    return;
+  }
+
+  await flood(host, port, size, duration);
+}
+
+/**
+ * Server binds `peers` sockets on consecutive ports. Client broadcasts the same `size` byte state to all of them
+ * `rounds` times, with a send per datagram or, with `many`, a single sendMany per round, and reports datagrams per
+ * second.
+ */
+async function udpFanout(server: boolean, host: string, port: number) {
+  const peers = option("peers", 100);
+  const rounds = option("rounds", 1000);
+  const size = option("size", 256);
+  const many = flag("many");
+
+  if (server) {
+    let received = 0;
+    for (let i = 0; i < peers; i++) {
+      const socket = dgram.createSocket({ type: "udp6" }, () => received++);
+      socket.bind(port + i);
+    }
+    setInterval(() => console.log(`received ${received}`), 1000);
+    return;
+  }
+
+  const socket = dgram.createSocket({ type: "udp6" });
+  const state = Buffer.alloc(size, 0x61);
+  const messages = Array.from({ length: peers }, (_, i) => ({
+    msg: state,
+    port: port + i,
+    address: host,
+  }));
+
+  const start = process.hrtime.bigint();
+  for (let round = 0; round < rounds; round++) {
+    if (many)
+      await new Promise((resolve) => socket.sendMany(messages, resolve));
+    else
+      await Promise.all(
+        messages.map(
+          ({ msg, port, address }) =>
+            new Promise((resolve) => socket.send(msg, port, address, resolve)),
+        ),
+      );
+  }
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+  report({
+    bench: "udp-fanout",
+    mode: many ? "sendMany" : "send",
+    peers,
+    rounds,
+    size,
+    seconds,
+    pps: (peers * rounds) / seconds,
+  });
+  socket.close(() => node.free());
+}
+
+/**
+ * Client sends `rounds` state updates of `size` bytes, either as a single datagram to a multicast group or, with
+ * `unicast`, as one datagram per peer, `peers` of them. Both modes target the same server socket, which joined the
+ * group, so only the sending side differs. Reports the time per update on the sending side. The server only counts
+ * unicast updates, as receiving multicast isn't supported.
+ */
+async function udpMulticast(server: boolean, host: string, port: number) {
+  const rounds = option("rounds", 1000);
+  const size = option("size", 256);
+  const peers = option("peers", 100);
+  const unicast = flag("unicast");
+  const group =
+    argIndex("group") < 0 ? "ff05::4242" : arg(argIndex("group") + 1);
+
+  if (server) {
+    let received = 0;
+    const socket = dgram.createSocket({ type: "udp6" }, () => received++);
+    socket.bind(port, undefined, () => socket.addMembership(group));
+    setInterval(() => console.log(`received ${received}`), 1000);
+    return;
+  }
+
+  const socket = dgram.createSocket({ type: "udp6" });
+  socket.setMulticastTTL(4);
+  const state = Buffer.alloc(size, 0x61);
+  // every peer is played by the server's single socket
+  const messages = Array.from({ length: peers }, () => ({
+    msg: state,
+    port,
+    address: host,
+  }));
+
+  const start = process.hrtime.bigint();
+  for (let round = 0; round < rounds; round++) {
+    if (unicast)
+      await new Promise((resolve) => socket.sendMany(messages, resolve));
+    else
+      await new Promise((resolve) => socket.send(state, port, group, resolve));
+  }
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+  report({
+    bench: "udp-multicast",
+    mode: unicast ? "unicast" : "multicast",
+    peers,
+    rounds,
+    size,
+    datagramsPerUpdate: unicast ? peers : 1,
+    usPerUpdate: (seconds * 1e6) / rounds,
+  });
+  socket.close(() => node.free());
+}
+
+/**
+ * Client sends `count` payloads of `size` bytes cut into `segment` byte datagrams, with a send per datagram or, with
+ * `gso`, a single sendSegments per payload, and reports datagrams per second. Server only receives.
+ */
+async function udpSegments(server: boolean, host: string, port: number) {
+  const count = option("count", 1000);
+  const size = option("size", 64 * 1024);
+  const segment = option("segment", 1200);
+  const gso = flag("gso");
+
+  if (server) {
+    let received = 0;
+    const socket = dgram.createSocket({ type: "udp6" }, () => received++);
+    socket.bind(port, undefined, () => console.log(socket.address()));
+    setInterval(() => console.log(`received ${received}`), 1000);
+    return;
+  }
+
+  const socket = dgram.createSocket({ type: "udp6" });
+  const payload = Buffer.alloc(size, 0x61);
+  const segments = Math.ceil(size / segment);
+
+  const start = process.hrtime.bigint();
+  for (let i = 0; i < count; i++) {
+    if (gso)
+      await new Promise((resolve) =>
+        socket.sendSegments(payload, segment, port, host, resolve),
+      );
+    else {
+      const sends: Promise<unknown>[] = [];
+      for (let offset = 0; offset < size; offset += segment) {
+        const msg = payload.subarray(offset, offset + segment);
+        sends.push(
+          new Promise((resolve) => socket.send(msg, port, host, resolve)),
+        );
+      }
+      await Promise.all(sends);
+    }
+  }
+  const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+  report({
+    bench: "udp-segments",
+    mode: gso ? "sendSegments" : "send",
+    count,
+    size,
+    segment,
+    seconds,
+    pps: (count * segments) / seconds,
+  });
+  socket.close(() => node.free());
+}
+
+/**
+ * Client issues `count` setNoDelay calls on a connection, each of which is a single command for the tcpip thread, and
+ * reports how many of them pass through the dispatch layer per second. With `latency`, the run is repeated with the
+ * latency histograms on to show their overhead, and their percentiles are reported. Server only accepts.
+ */
+async function dispatch(server: boolean, host: string, port: number) {
+  const count = option("count", 1_000_000);
+  const latency = flag("latency");
+
+  if (server) {
+    const srv = net.createServer((socket) => socket.resume());
+    srv.listen(port, () => console.log(srv.address()));
+    return;
+  }
+
+  const socket = net.connect({ port, host });
+  await new Promise((resolve) => socket.once("connect", resolve));
+
+  const run = async (tracking: boolean) => {
+    const start = process.hrtime.bigint();
+    for (let i = 0; i < count; i++) socket.setNoDelay(i % 2 === 0);
+    // commands are executed in order, so once this write has been handed to lwip all of the above have run
+    await new Promise((resolve) => socket.write(new Uint8Array(1), resolve));
+    const seconds = Number(process.hrtime.bigint() - start) / 1e9;
+
+    const result: Record<string, unknown> = {
+      bench: "dispatch",
+      latency: tracking,
+      count,
+      seconds,
+      opsPerSecond: count / seconds,
+      rss: process.memoryUsage.rss(),
+    };
+    if (tracking) {
+      const histograms = node.getLatencyHistograms(true);
+      (["tcpipWait", "tcpipBusy", "completionWait"] as const).forEach(
+        (name) => {
+          const h = histograms[name];
+          result[name] = { p50: h.p50, p99: h.p99, p999: h.p999, max: h.max };
+        },
+      );
+    }
+    report(result);
+  };
+
+  await run(false);
+  if (latency) {
+    node.setLatencyTracking(true);
+    await run(true);
+    node.setLatencyTracking(false);
+  }
+  socket.destroy();
+  node.free();
+}
+
+const benchmarks: Record<
+  string,
+  (server: boolean, host: string, port: number) => Promise<void>
+> = {
+  "tcp-recv": tcpRecv,
+  "tcp-slow-readers": tcpSlowReaders,
+  "tcp-accept": tcpAccept,
+  "tcp-idle": tcpIdle,
+  "udp-send": udpSend,
+  "udp-flood": udpFlood,
+  "udp-recv": udpRecv,
+  "udp-fanout": udpFanout,
+  "udp-multicast": udpMulticast,
+  "udp-segments": udpSegments,
+  dispatch,
+};
+
+async function main() {
+  // workers run the benchmark's server side with the main thread's arguments
+  if (isMainThread) {
+    console.log(`
+Benchmarks using ad-hoc network. Results are printed as one JSON object per line.
+
+usage: <cmd> <benchmark> [options]
+
+benchmarks:
+    tcp-recv                // server sends data, client measures receive throughput
+        size <MB>           // amount of data, default 100
+        zerocopy            // client receives into external buffers instead of copying
+        chunk <bytes>       // client merges received data into chunks of this size, default 65536
+    tcp-slow-readers        // server writes to many connections, client reads slowly and reports memory usage
+        conns <n>           // number of connections, default 100
+        interval <ms>       // time between reads of a single chunk per connection, default 100
+        duration <s>        // time after which memory usage is reported, default 10
+    tcp-accept              // client opens and closes connections, reports connections per second
+        count <n>           // number of connections, default 10000
+        parallel <n>        // maximum connections being set up at once, default 256
+        backlog <n>         // server listen backlog, default 511
+        max <n>             // server maxConnections, default unlimited
+        workers <n>         // server also accepts in this many worker threads, default 0
+    tcp-idle                // client holds many idle connections with timeouts, reports memory and cpu usage
+        conns <n>           // number of connections, default 50000
+        parallel <n>        // maximum connections being set up at once, default 256
+        timeout <ms>        // idle timeout per connection, default 60000
+        duration <s>        // time over which cpu usage is measured, default 10
+        jstimers            // client uses a js timer per connection instead of the native idle timeout
+    udp-send                // client sends datagrams, reports send rate and completion latency
+        count <n>           // number of datagrams, default 100000
+        size <bytes>        // datagram size, default 64
+        window <n>          // maximum sends in flight, default 64
+    udp-flood               // client floods, server stalls periodically and reports drops and memory usage
+        size <bytes>        // datagram size, default 1024
+        duration <s>        // time the client sends for, default 10
+        stall <ms>          // time per second the server blocks its event loop, default 500
+    udp-recv                // client floods, server reports received datagrams per second
+        size <bytes>        // datagram size, default 64
+        duration <s>        // time the client sends for, default 10
+        batch               // server receives batches instead of a message event per datagram
+        ring                // server busy-polls a shared memory ring instead of receiving events
+        capacity <bytes>    // ring capacity, default 4194304
+    udp-fanout              // client broadcasts to many server sockets, reports datagrams per second
+        peers <n>           // number of server sockets on consecutive ports, default 100
+        rounds <n>          // number of broadcasts, default 1000
+        size <bytes>        // datagram size, default 256
+        many                // client uses a single sendMany per broadcast instead of a send per datagram
+    udp-multicast           // client sends updates to a multicast group or to every peer, reports cost per update
+        rounds <n>          // number of updates, default 1000
+        size <bytes>        // update size, default 256
+        peers <n>           // number of datagrams per update for unicast, default 100
+        group <addr>        // multicast group, default ff05::4242
+        unicast             // client sends a datagram per peer with sendMany instead of one multicast datagram
+    udp-segments            // client sends large payloads cut into datagrams, reports datagrams per second
+        count <n>           // number of payloads, default 1000
+        size <bytes>        // payload size, default 65536
+        segment <bytes>     // datagram size, default 1200
+        gso                 // client uses a single sendSegments per payload instead of a send per datagram
+    dispatch                // client measures commands per second through the tcpip dispatch layer
+        count <n>           // number of commands, default 1000000
+        latency             // repeats the run with latency histograms recording and reports their percentiles
+
+available options:
+    client <server ip>      // starts a client, if unspecified starts a server
+    port <port>             // specify a port, otherwise 5555
+    network <nwid>          // specify the network id, otherwise adhoc network
+    `);
+  }
+
+  const bench = benchmarks[arg(2)];
+  if (!bench) return;
+
+  const server = argIndex("client") < 0;
+  const host = server ? "" : arg(argIndex("client") + 1);
+  const port = option("port", 5555);
+  const nwid =
+    argIndex("network") < 0 ? "ff0000ffff000000" : arg(argIndex("network") + 1);
+
+  // workers attach to the node started by the main thread
+  await node.start({});
+  await node.joinNetwork(nwid);
+  console.log(`Node address: ${node.getIPv6Address(nwid)}`);
+
+  if (!server) await setTimeout(1000);
+  await bench(server, host, port);
+}
+
+main();